@@ -0,0 +1,651 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "cprs_internal.h"
+
+#define CORE_NAME decode_plain
+#define CORE_STATS 0
+#include "cprs_decode_core.h"
+
+#define CORE_NAME decode_counted
+#define CORE_STATS 1
+#include "cprs_decode_core.h"
+
+#define CORE_NAME decode_indexing
+#define CORE_STATS 0
+#define CORE_INDEX 1
+#include "cprs_decode_core.h"
+
+#define CORE_NAME decode_ranged
+#define CORE_STATS 0
+#define CORE_RANGE 1
+#include "cprs_decode_core.h"
+
+#define CORE_NAME decode_head
+#define CORE_STATS 0
+#define CORE_HEAD 1
+#include "cprs_decode_core.h"
+
+/*  Appends a record to the batch in `span`, handing the batch to the sink
+    once it is full. `bits` are the stream bits at the start of the token,
+    which is where its length group and distance code are read from. */
+static inline int trace_token(cprs_span* span, uint64_t bits, uint64_t bitPos, uint32_t kind,
+                              uint32_t length, uint32_t distance, size_t outPos) {
+    uint8_t* record = span->records + (size_t)span->recordCount * CPRS_TRACE_RECORD_SIZE;
+    uint32_t rows = 0;
+    if (kind != CPRS_TRACE_LITERAL) {
+        uint32_t group = bits >> 1 & 3;
+        rows = group << 2 | (uint32_t)(bits >> (3 + CPRS_TABLE[group * 4]) & 0xf) << 4;
+    }
+
+    store32le(record, (uint32_t)bitPos);
+    record[4] = (uint8_t)(bitPos >> 32);
+    record[5] = (uint8_t)(kind | rows);
+    record[6] = (uint8_t)length;
+    record[7] = (uint8_t)(length >> 8);
+    store32le(record + 8, distance);
+    store32le(record + 12, (uint32_t)outPos);
+
+    if (++span->recordCount < CPRS_TRACE_BATCH) {
+        return 1;
+    }
+    span->recordCount = 0;
+    return span->sink(span->context, span->records, CPRS_TRACE_BATCH) == 0;
+}
+
+#define CORE_NAME decode_inplace
+#define CORE_STATS 0
+#define CORE_INPLACE 1
+#include "cprs_decode_core.h"
+
+#define CORE_NAME decode_traced
+#define CORE_STATS 0
+#define CORE_TRACE 1
+#include "cprs_decode_core.h"
+
+static int decode(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen, cprs_stats* stats);
+
+/*  Runtime dispatch of the plain decoder. With CPRS_DISPATCH the Makefile
+    links in copies of the loop built for newer x86-64 levels
+    (cprs_decode_isa.c) and the first decode picks the best one the CPU
+    has, unless the CPRS_ISA environment variable names another. Without
+    it (other architectures, builds outside the Makefile) the loop is only
+    ever built for the compiler's target. */
+typedef int (*decode_fn)(const uint8_t* data, size_t inLen, uint8_t* out, size_t outCap, size_t* outLen);
+
+static int decode_baseline(const uint8_t* data, size_t inLen, uint8_t* out, size_t outCap, size_t* outLen) {
+    return decode_plain(data, inLen, out, outCap, outLen, 0, 0);
+}
+
+#if defined(CPRS_DISPATCH) && defined(__x86_64__) && defined(__GNUC__)
+int cprs_decode_x86_64_v2(const uint8_t* data, size_t inLen, uint8_t* out, size_t outCap, size_t* outLen);
+int cprs_decode_avx2(const uint8_t* data, size_t inLen, uint8_t* out, size_t outCap, size_t* outLen);
+int cprs_decode_avx512(const uint8_t* data, size_t inLen, uint8_t* out, size_t outCap, size_t* outLen);
+
+/*  In order of preference. The AVX-512 build is only used when asked for:
+    the loop is scalar apart from its copies, which AVX2 already covers,
+    and measured no faster than the AVX2 build. */
+static const struct {
+    const char* name;
+    decode_fn fn;
+    int automatic;
+} isaVariants[] = {
+    { "avx512", cprs_decode_avx512, 0 },
+    { "avx2", cprs_decode_avx2, 1 },
+    { "x86-64-v2", cprs_decode_x86_64_v2, 1 },
+    { "baseline", decode_baseline, 1 },
+};
+
+#define ISA_COUNT (sizeof(isaVariants) / sizeof(isaVariants[0]))
+
+/*  Each variant is built with -march=x86-64-vN, which lets the compiler use
+    anything in that level, so the whole level has to be there. */
+#if (defined(__clang__) && __clang_major__ >= 16) || (!defined(__clang__) && __GNUC__ >= 12)
+static int isa_supported(size_t i) {
+    __builtin_cpu_init();
+    switch (i) {
+    case 0:
+        return __builtin_cpu_supports("x86-64-v4");
+    case 1:
+        return __builtin_cpu_supports("x86-64-v3");
+    case 2:
+        return __builtin_cpu_supports("x86-64-v2");
+    default:
+        return 1;
+    }
+}
+#else
+static int isa_v2(void) {
+    return __builtin_cpu_supports("cmpxchg16b") && __builtin_cpu_supports("lahf_lm")
+        && __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("sse3")
+        && __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1")
+        && __builtin_cpu_supports("sse4.2");
+}
+
+static int isa_v3(void) {
+    return isa_v2() && __builtin_cpu_supports("avx") && __builtin_cpu_supports("avx2")
+        && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2")
+        && __builtin_cpu_supports("f16c") && __builtin_cpu_supports("fma")
+        && __builtin_cpu_supports("lzcnt") && __builtin_cpu_supports("movbe");
+}
+
+static int isa_supported(size_t i) {
+    __builtin_cpu_init();
+    switch (i) {
+    case 0:
+        return isa_v3() && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+            && __builtin_cpu_supports("avx512cd") && __builtin_cpu_supports("avx512dq")
+            && __builtin_cpu_supports("avx512vl");
+    case 1:
+        return isa_v3();
+    case 2:
+        return isa_v2();
+    default:
+        return 1;
+    }
+}
+#endif
+
+/*  Index into isaVariants, resolved once. Racing first calls all store
+    the same value. */
+static int isaSelected = -1;
+
+static size_t isa_select(void) {
+    int selected = __atomic_load_n(&isaSelected, __ATOMIC_RELAXED);
+    if (selected >= 0) {
+        return (size_t)selected;
+    }
+
+    const char* forced = getenv("CPRS_ISA");
+    size_t i = 0;
+    for (; i < ISA_COUNT - 1; ++i) {
+        if (forced ? strcmp(forced, isaVariants[i].name) != 0 : !isaVariants[i].automatic) {
+            continue;
+        }
+        if (isa_supported(i)) {
+            break;
+        }
+    }
+    __atomic_store_n(&isaSelected, (int)i, __ATOMIC_RELAXED);
+    return i;
+}
+
+static decode_fn decode_select(void) {
+    return isaVariants[isa_select()].fn;
+}
+
+const char* cprs_decode_isa(void) {
+    return isaVariants[isa_select()].name;
+}
+#else
+static decode_fn decode_select(void) {
+    return decode_baseline;
+}
+
+const char* cprs_decode_isa(void) {
+    return "baseline";
+}
+#endif
+
+int cprs_header_peek(const void* in, size_t inLen, cprs_header* header) {
+    const uint8_t* data = in;
+
+    if (inLen % 4 != 0) {
+        return CPRS_E_ALIGN;
+    }
+
+    if (inLen <= CPRS_HEADER_SIZE) {
+        return CPRS_E_SMALL;
+    }
+
+    if (load32le(data) != CPRS_SIG || load32le(data + inLen - 4) != CPRS_SIG) {
+        return CPRS_E_SIG;
+    }
+
+    if (header) {
+        header->compressedSize = load32le(data + 4);
+        header->decompressedSize = load32le(data + 8);
+    }
+    return CPRS_OK;
+}
+
+int cprs_member(const void* in, size_t inLen, size_t offset, cprs_header* header) {
+    const uint8_t* data = in;
+
+    if (offset > inLen || offset % 4 != 0) {
+        return CPRS_E_ALIGN;
+    }
+    if (inLen - offset <= CPRS_HEADER_SIZE) {
+        return CPRS_E_SMALL;
+    }
+    if (load32le(data + offset) != CPRS_SIG) {
+        return CPRS_E_SIG;
+    }
+
+    uint32_t compressedSize = load32le(data + offset + 4);
+    if (compressedSize > inLen - offset) {
+        return CPRS_E_TRUNC;
+    }
+    return cprs_header_peek(data + offset, compressedSize, header);
+}
+
+int cprs_decode(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen) {
+    return decode(in, inLen, out, outCap, outLen, 0);
+}
+
+int cprs_decode_stats(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen, cprs_stats* stats) {
+    memset(stats, 0, sizeof(cprs_stats));
+    return decode(in, inLen, out, outCap, outLen, stats);
+}
+
+static int decode(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen, cprs_stats* stats) {
+    cprs_header header;
+    int status = cprs_header_peek(in, inLen, &header);
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    if (outCap < header.decompressedSize) {
+        return CPRS_E_SPACE;
+    }
+
+    size_t decoded;
+    status = stats
+        ? decode_counted(in, inLen, out, outCap, &decoded, stats, 0)
+        : decode_select()(in, inLen, out, outCap, &decoded);
+
+    if (outLen) {
+        *outLen = decoded;
+    }
+    return status;
+}
+
+int cprs_decode_trace(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen,
+                      cprs_trace_sink sink, void* context) {
+    cprs_header header;
+    int status = cprs_header_peek(in, inLen, &header);
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    if (outCap < header.decompressedSize) {
+        return CPRS_E_SPACE;
+    }
+
+    uint8_t records[CPRS_TRACE_BATCH * CPRS_TRACE_RECORD_SIZE];
+    cprs_span span;
+    memset(&span, 0, sizeof(span));
+    span.records = records;
+    span.sink = sink;
+    span.context = context;
+
+    size_t decoded;
+    status = decode_traced(in, inLen, out, outCap, &decoded, 0, &span);
+
+    /*  The last partial batch goes out even after an error, since it ends
+        with the token that caused it. */
+    if (status != CPRS_E_TRACE && span.recordCount
+            && sink(context, records, span.recordCount) != 0 && status == CPRS_OK) {
+        status = CPRS_E_TRACE;
+    }
+
+    if (outLen) {
+        *outLen = decoded;
+    }
+    return status;
+}
+
+/*  Terminator, bytes after the end of the bitstream (alignment and the
+    trailing signature, with some to spare) and the furthest a token
+    writes past the output position in decode_inplace(). */
+#define INPLACE_SLACK (4 + 16 + CPRS_MAX_TOKEN_OUTPUT + COPY_SLACK)
+
+size_t cprs_inplace_margin(size_t compressedSize) {
+    /*  Output only gains on unread input through literals, which write 8
+        bits for every 9 they consume (no match can do worse), and through
+        the terminator, which writes nothing. */
+    return (compressedSize + 8) / 9 + INPLACE_SLACK;
+}
+
+size_t cprs_inplace_size(const cprs_header* header) {
+    size_t larger = header->decompressedSize > header->compressedSize
+        ? header->decompressedSize : header->compressedSize;
+    return larger + cprs_inplace_margin(header->compressedSize);
+}
+
+int cprs_decode_inplace(void* buffer, size_t bufferLen, size_t inLen, size_t* outLen) {
+    if (inLen > bufferLen) {
+        return CPRS_E_SMALL;
+    }
+
+    uint8_t* in = (uint8_t*)buffer + bufferLen - inLen;
+    cprs_header header;
+    int status = cprs_header_peek(in, inLen, &header);
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    if (bufferLen < header.decompressedSize) {
+        return CPRS_E_SPACE;
+    }
+
+    size_t decoded;
+    status = decode_inplace(in, inLen, buffer, header.decompressedSize, &decoded, 0, 0);
+
+    if (outLen) {
+        *outLen = decoded;
+    }
+    return status;
+}
+
+int cprs_decode_head(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen) {
+    cprs_header header;
+    int status = cprs_header_peek(in, inLen, &header);
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    if (outCap > header.decompressedSize) {
+        outCap = header.decompressedSize;
+    }
+
+    size_t decoded;
+    status = decode_head(in, inLen, out, outCap, &decoded, 0, 0);
+
+    if (outLen) {
+        *outLen = decoded;
+    }
+    return status;
+}
+
+size_t cprs_index_bound(size_t decompressedSize, size_t interval) {
+    if (interval == 0) {
+        interval = CPRS_INDEX_INTERVAL;
+    }
+    return CPRS_INDEX_HEADER_SIZE
+        + (decompressedSize / interval + 1) * (CPRS_INDEX_ENTRY_SIZE + CPRS_WINDOW_SIZE);
+}
+
+int cprs_decode_indexed(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen,
+                        size_t interval, void* index, size_t indexCap, size_t* indexLen) {
+    cprs_header header;
+    int status = cprs_header_peek(in, inLen, &header);
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    if (interval == 0) {
+        interval = CPRS_INDEX_INTERVAL;
+    }
+
+    if (outCap < header.decompressedSize || interval > UINT32_MAX
+            || indexCap < cprs_index_bound(header.decompressedSize, interval)) {
+        return CPRS_E_SPACE;
+    }
+
+    uint8_t* data = index;
+    cprs_span span;
+    memset(&span, 0, sizeof(span));
+    span.interval = interval;
+    span.entries = data + CPRS_INDEX_HEADER_SIZE;
+    span.capacity = (uint32_t)(header.decompressedSize / interval + 1);
+
+    size_t decoded;
+    status = decode_indexing(in, inLen, out, outCap, &decoded, 0, &span);
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    /*  The windows go after all the entries, each one the output just
+        before its checkpoint. */
+    uint8_t* window = span.entries + (size_t)span.count * CPRS_INDEX_ENTRY_SIZE;
+    for (uint32_t i = 0; i < span.count; ++i) {
+        uint8_t* entry = span.entries + (size_t)i * CPRS_INDEX_ENTRY_SIZE;
+        uint32_t outPos = load32le(entry + 8);
+        uint32_t windowLen = outPos < CPRS_WINDOW_SIZE ? outPos : CPRS_WINDOW_SIZE;
+        store32le(entry + 12, windowLen);
+        memcpy(window, (uint8_t*)out + outPos - windowLen, windowLen);
+        window += windowLen;
+    }
+
+    store32le(data, CPRS_INDEX_SIG);
+    store32le(data + 4, (uint32_t)interval);
+    store32le(data + 8, span.count);
+    store32le(data + 12, header.compressedSize);
+    store32le(data + 16, header.decompressedSize);
+
+    if (outLen) {
+        *outLen = decoded;
+    }
+    if (indexLen) {
+        *indexLen = window - data;
+    }
+    return CPRS_OK;
+}
+
+int cprs_index_build(const void* in, size_t inLen, size_t interval, void* index, size_t indexCap, size_t* indexLen) {
+    cprs_header header;
+    int status = cprs_header_peek(in, inLen, &header);
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    if (interval == 0) {
+        interval = CPRS_INDEX_INTERVAL;
+    }
+
+    if (interval > UINT32_MAX || indexCap < cprs_index_bound(header.decompressedSize, interval)) {
+        return CPRS_E_SPACE;
+    }
+
+    /*  Holds the window ahead of the current checkpoint and the output up
+        to the first token boundary past the next one. */
+    uint8_t* buffer = malloc(CPRS_WINDOW_SIZE + interval + CPRS_MAX_TOKEN_OUTPUT);
+    if (!buffer) {
+        return CPRS_E_NOMEM;
+    }
+
+    /*  The number of checkpoints isn't known until the end, so the windows
+        start after room for as many as there can be and are moved down to
+        follow the entries afterwards. */
+    uint8_t* data = index;
+    uint8_t* entries = data + CPRS_INDEX_HEADER_SIZE;
+    uint32_t capacity = (uint32_t)(header.decompressedSize / interval + 1);
+    uint8_t* windows = entries + (size_t)capacity * CPRS_INDEX_ENTRY_SIZE;
+    uint8_t* window = windows;
+    uint32_t count = 0;
+
+    uint64_t bitPos = 0;
+    size_t outPos = 0;
+    size_t windowLen = 0;
+    while (1) {
+        if (count < capacity) {
+            uint8_t* entry = entries + (size_t)count++ * CPRS_INDEX_ENTRY_SIZE;
+            store32le(entry, (uint32_t)bitPos);
+            store32le(entry + 4, (uint32_t)(bitPos >> 32));
+            store32le(entry + 8, (uint32_t)outPos);
+            store32le(entry + 12, (uint32_t)windowLen);
+            memcpy(window, buffer, windowLen);
+            window += windowLen;
+        }
+
+        cprs_span span;
+        memset(&span, 0, sizeof(span));
+        span.bitPos = bitPos;
+        span.outPos = windowLen;
+        span.stop = windowLen + (outPos / interval * interval + interval - outPos);
+
+        size_t decoded;
+        status = decode_ranged(in, inLen, buffer, span.stop + CPRS_MAX_TOKEN_OUTPUT, &decoded, 0, &span);
+        if (status == CPRS_OK && outPos + (decoded - windowLen) > header.decompressedSize) {
+            status = CPRS_E_CORRUPT;
+        }
+        if (status != CPRS_OK) {
+            free(buffer);
+            return status;
+        }
+
+        /*  Short of the stop means the terminator came first. */
+        if (decoded < span.stop) {
+            break;
+        }
+
+        outPos += decoded - windowLen;
+        bitPos = span.bitPos;
+        windowLen = outPos < CPRS_WINDOW_SIZE ? outPos : CPRS_WINDOW_SIZE;
+        memmove(buffer, buffer + decoded - windowLen, windowLen);
+    }
+    free(buffer);
+
+    uint8_t* end = entries + (size_t)count * CPRS_INDEX_ENTRY_SIZE;
+    memmove(end, windows, window - windows);
+    end += window - windows;
+
+    store32le(data, CPRS_INDEX_SIG);
+    store32le(data + 4, (uint32_t)interval);
+    store32le(data + 8, count);
+    store32le(data + 12, header.compressedSize);
+    store32le(data + 16, header.decompressedSize);
+
+    if (indexLen) {
+        *indexLen = end - data;
+    }
+    return CPRS_OK;
+}
+
+int cprs_decode_range(const void* in, size_t inLen, const void* index, size_t indexLen,
+                      size_t offset, void* out, size_t length, size_t* outLen) {
+    cprs_header header;
+    int status = cprs_header_peek(in, inLen, &header);
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    if (offset > header.decompressedSize || length > header.decompressedSize - offset) {
+        return CPRS_E_RANGE;
+    }
+
+    /*  A span at the start needs no window, so it can be decoded straight
+        into `out`. */
+    if (offset == 0) {
+        return cprs_decode_head(in, inLen, out, length, outLen);
+    }
+
+    /*  Without an index the span is decoded from the start. */
+    uint64_t bitPos = 0;
+    size_t checkpoint = 0;
+    const uint8_t* window = 0;
+    size_t windowLen = 0;
+
+    if (index) {
+        const uint8_t* data = index;
+        if (indexLen < CPRS_INDEX_HEADER_SIZE || load32le(data) != CPRS_INDEX_SIG
+                || load32le(data + 12) != header.compressedSize
+                || load32le(data + 16) != header.decompressedSize) {
+            return CPRS_E_INDEX;
+        }
+
+        uint32_t count = load32le(data + 8);
+        const uint8_t* entries = data + CPRS_INDEX_HEADER_SIZE;
+        if (count == 0 || (indexLen - CPRS_INDEX_HEADER_SIZE) / CPRS_INDEX_ENTRY_SIZE < count) {
+            return CPRS_E_INDEX;
+        }
+
+        /*  Last checkpoint at or before `offset`; they are in output order. */
+        size_t windowOffset = CPRS_INDEX_HEADER_SIZE + (size_t)count * CPRS_INDEX_ENTRY_SIZE;
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint8_t* entry = entries + (size_t)i * CPRS_INDEX_ENTRY_SIZE;
+            if (load32le(entry + 8) > offset) {
+                break;
+            }
+            if (window) {
+                windowOffset += windowLen;
+            }
+            bitPos = load32le(entry) | (uint64_t)load32le(entry + 4) << 32;
+            checkpoint = load32le(entry + 8);
+            windowLen = load32le(entry + 12);
+            window = data + windowOffset;
+        }
+
+        if (!window || windowLen > checkpoint || windowLen > CPRS_WINDOW_SIZE
+                || windowOffset > indexLen || windowLen > indexLen - windowOffset
+                || bitPos / 8 > inLen - 12) {
+            return CPRS_E_INDEX;
+        }
+    }
+
+    size_t stop = windowLen + (offset - checkpoint) + length;
+    uint8_t* buffer = malloc(stop + CPRS_MAX_TOKEN_OUTPUT);
+    if (!buffer) {
+        return CPRS_E_NOMEM;
+    }
+    if (windowLen) {
+        memcpy(buffer, window, windowLen);
+    }
+
+    cprs_span span;
+    memset(&span, 0, sizeof(span));
+    span.bitPos = bitPos;
+    span.outPos = windowLen;
+    span.stop = stop;
+
+    size_t decoded;
+    status = decode_ranged(in, inLen, buffer, stop + CPRS_MAX_TOKEN_OUTPUT, &decoded, 0, &span);
+    if (status != CPRS_OK) {
+        free(buffer);
+        return status;
+    }
+
+    /*  A stream that ends early leaves the tail of the span undecoded. */
+    size_t start = windowLen + (offset - checkpoint);
+    size_t produced = decoded < start ? 0 : decoded - start;
+    if (produced > length) {
+        produced = length;
+    }
+    memcpy(out, buffer + start, produced);
+    free(buffer);
+
+    if (outLen) {
+        *outLen = produced;
+    }
+    return CPRS_OK;
+}
+
+const char* cprs_strerror(int status) {
+    switch (status) {
+    case CPRS_OK:       return "Success";
+    case CPRS_E_ALIGN:  return "Source buffer not 4-byte aligned";
+    case CPRS_E_SMALL:  return "Source buffer too small";
+    case CPRS_E_SIG:    return "CPRS signature check failed";
+    case CPRS_E_SPACE:  return "Destination buffer too small";
+    case CPRS_E_TRUNC:  return "Source buffer truncated";
+    case CPRS_E_LARGE:  return "Source buffer too large";
+    case CPRS_E_NOMEM:  return "Out of memory";
+    case CPRS_E_INDEX:  return "Index does not match the source buffer";
+    case CPRS_E_RANGE:  return "Range outside the decompressed data";
+    case CPRS_E_CORRUPT: return "Corrupt bitstream";
+    case CPRS_E_TRACE:  return "Trace sink failed";
+    case CPRS_STREAM_FULL:  return "Stream window full";
+    case CPRS_STREAM_END:   return "End of stream";
+    default:            return "Unknown error";
+    }
+}
@@ -0,0 +1,283 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPRS_H
+#define CPRS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*  A CPRS blob is a sequence of little-endian 32-bit words:
+
+        [0]     CPRS_SIG
+        [1]     compressedSize
+        [2]     decompressedSize
+        [3..]   bitstream, starting with the initial alpha/beta words
+        [n-1]   CPRS_SIG
+ */
+
+#define CPRS_SIG ((uint32_t)0x53525043)
+#define CPRS_TERM 0x10002
+
+#define CPRS_HEADER_SIZE 20
+
+/*  Furthest back a match can reach: the largest non-terminating distance
+    code is CPRS_TERM - 1, in units of 2 bytes. */
+#define CPRS_WINDOW_SIZE (2 * (CPRS_TERM - 1))
+
+/*  Status codes. Errors are negative. */
+#define CPRS_OK          0
+#define CPRS_E_ALIGN    -1
+#define CPRS_E_SMALL    -2
+#define CPRS_E_SIG      -3
+#define CPRS_E_SPACE    -4
+#define CPRS_E_TRUNC    -5
+#define CPRS_E_LARGE    -6
+#define CPRS_E_NOMEM    -7
+#define CPRS_E_INDEX    -8
+#define CPRS_E_RANGE    -9
+#define CPRS_E_CORRUPT  -10
+#define CPRS_E_TRACE    -11
+
+/*  Non-error results of the streaming decoder. */
+#define CPRS_STREAM_FULL 1
+#define CPRS_STREAM_END  2
+
+typedef struct cprs_header {
+    uint32_t compressedSize;
+    uint32_t decompressedSize;
+} cprs_header;
+
+/*  Validates the framing of the blob at `in` and reads its size fields.
+    Does not touch the bitstream. */
+int cprs_header_peek(const void* in, size_t inLen, cprs_header* header);
+
+/*  Files may hold several blobs ("members") back to back, each framed on
+    its own. Reads the framing of the one at `offset`, checking that its
+    compressedSize lands on its trailing CPRS_SIG within `inLen`; the next
+    member starts at offset + header->compressedSize. */
+int cprs_member(const void* in, size_t inLen, size_t offset, cprs_header* header);
+
+/*  Finds the first member at or after `offset` in an arbitrary image (a
+    flash dump, say): a CPRS_SIG word at a multiple of 4 from `in` whose
+    compressedSize lands on a trailing CPRS_SIG inside the image. Stores
+    its position in `memberOffset` and its size fields in `header` (if
+    non-null), or returns CPRS_E_SIG when there is none. The member can
+    then be handed to cprs_decode() as in + *memberOffset with
+    header->compressedSize bytes. */
+int cprs_scan(const void* in, size_t inLen, size_t offset, size_t* memberOffset, cprs_header* header);
+
+/*  Decodes the blob at `in` into `out`. `outCap` must be at least the
+    header's decompressedSize. The output buffer is not zero-filled and
+    nothing is written past the last decoded byte. On success the number
+    of decoded bytes is stored in `outLen` (if non-null).
+
+    No allocation and no stdio happen in here, and nothing outside `in`
+    and `out` is ever touched, whatever the bitstream holds. A stream that
+    runs out before its terminator gets CPRS_E_TRUNC, one that would write
+    past `outCap` or refer back before the start of the output gets
+    CPRS_E_CORRUPT. `outLen` is set in either case to what was decoded. */
+int cprs_decode(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen);
+
+/*  Decodes only the first `outCap` bytes of the output (or all of it, if
+    the header's decompressedSize is smaller) and stops there, so a caller
+    after a file's leading headers needs a buffer of that size only and
+    doesn't pay for the rest of the stream. `outLen` is short only if the
+    stream ends early. Errors are as for cprs_decode(). */
+int cprs_decode_head(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen);
+
+/*  Instruction set the cprs_decode() loop runs with on this machine:
+    "baseline" (whatever the library was compiled for), or with runtime
+    dispatch "x86-64-v2", "avx2" or "avx512". Setting the CPRS_ISA
+    environment variable to one of those, before the first decode, forces
+    it if the CPU supports it. */
+const char* cprs_decode_isa(void);
+
+/*  Counters gathered by cprs_decode_stats(), which is a separately compiled
+    copy of cprs_decode() so the plain decoder doesn't pay for them. */
+#define CPRS_STATS_BUCKETS 18
+
+typedef struct cprs_stats {
+    uint64_t literalTokens;
+    uint64_t runTokens;         /* distance 0 matches */
+    uint64_t runBytes;
+    uint64_t matchTokens;       /* back-references */
+    uint64_t matchBytes;
+    uint64_t refills;           /* bit buffer refills */
+
+    /*  Bucket i counts values from 2^i up to 2^(i+1) - 1: lengths of all
+        matches (runs included) and byte distances of back-references. */
+    uint64_t lengths[CPRS_STATS_BUCKETS];
+    uint64_t distances[CPRS_STATS_BUCKETS];
+} cprs_stats;
+
+/*  cprs_decode() that also fills in `stats` (zeroing it first). */
+int cprs_decode_stats(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen, cprs_stats* stats);
+
+/*  Token trace for studying the format. cprs_decode_trace() is
+    cprs_decode() that also hands a record of every token (the terminator
+    included) to `sink`, up to CPRS_TRACE_BATCH at a time. Records are
+    CPRS_TRACE_RECORD_SIZE bytes, little-endian:
+
+        bytes  0..4   payload bit offset of the token (40 bits)
+        byte   5      kind (CPRS_TRACE_*) in bits 0..1; for everything
+                      but literals the CPRS_TABLE length group (row) in
+                      bits 2..3 and distance code (row - 4) in bits 4..7
+        bytes  6..7   length with the distance code's bonus, or the byte
+                      of a literal
+        bytes  8..11  distance as coded, in 2-byte units
+        bytes 12..15  output offset of the token
+
+    A token that fails the decode is still recorded, as the last one. A
+    sink returning non-zero stops the decode with CPRS_E_TRACE. */
+#define CPRS_TRACE_RECORD_SIZE  16
+#define CPRS_TRACE_BATCH        1024
+
+#define CPRS_TRACE_LITERAL  0
+#define CPRS_TRACE_RUN      1
+#define CPRS_TRACE_MATCH    2
+#define CPRS_TRACE_END      3
+
+typedef int (*cprs_trace_sink)(void* context, const void* records, size_t count);
+
+int cprs_decode_trace(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen,
+                      cprs_trace_sink sink, void* context);
+
+/*  Random access. cprs_decode_indexed() is cprs_decode() that also writes
+    a checkpoint index: every `interval` bytes of output (CPRS_INDEX_INTERVAL
+    if 0) it records the bit position of the next token and the
+    CPRS_WINDOW_SIZE bytes of output a back-reference from there can reach.
+    `indexCap` must be at least cprs_index_bound(); `indexLen` gets the size
+    actually used, which is what should be kept (in a sidecar file, say).
+
+    cprs_decode_range() then decodes just `length` bytes at `offset` of the
+    output into `out`, starting from the closest checkpoint before it, so
+    the work is proportional to the span and the interval rather than the
+    whole image. With a null `index` it decodes from the start. `outLen`
+    gets the number of bytes produced, short only if the stream ends before
+    the header's decompressedSize.
+
+    cprs_index_build() writes the same index as cprs_decode_indexed()
+    without an output buffer, decoding through one of about `interval`
+    bytes instead, for images too big to decode in memory. */
+#define CPRS_INDEX_SIG ((uint32_t)0x49525043)
+#define CPRS_INDEX_INTERVAL 0x100000
+
+size_t cprs_index_bound(size_t decompressedSize, size_t interval);
+
+int cprs_decode_indexed(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen,
+                        size_t interval, void* index, size_t indexCap, size_t* indexLen);
+
+int cprs_index_build(const void* in, size_t inLen, size_t interval, void* index, size_t indexCap, size_t* indexLen);
+
+int cprs_decode_range(const void* in, size_t inLen, const void* index, size_t indexLen,
+                      size_t offset, void* out, size_t length, size_t* outLen);
+
+/*  In-place decoding into one buffer, as the MCU does it: the blob's
+    `inLen` bytes sit at the very end of `buffer` and the output is written
+    from its start. cprs_inplace_size() gives a buffer big enough for any
+    blob whose bitstream ends where an encoder puts it: the larger of the
+    two sizes in the header plus cprs_inplace_margin() of the
+    compressedSize. If the output still catches up with input that hasn't
+    been read yet, the decode stops with CPRS_E_SPACE. It never reads
+    bytes it has already overwritten. */
+size_t cprs_inplace_margin(size_t compressedSize);
+size_t cprs_inplace_size(const cprs_header* header);
+
+int cprs_decode_inplace(void* buffer, size_t bufferLen, size_t inLen, size_t* outLen);
+
+/*  Experimental speculative decoding of one stream on several threads,
+    without a multi-member layout. cprs_parallel_begin() cuts the bitstream
+    into up to `regions` stretches of at least CPRS_PARALLEL_MIN_REGION
+    bytes and finds a token boundary near the start of each (a stretch
+    where none turns up is left to the one before it).
+    cprs_parallel_decode() decodes one of the cprs_parallel_regions()
+    stretches and can run on any thread, all of them at once. Output that
+    a stretch copies from before its own start is left as placeholders.
+    cprs_parallel_finish() then checks that every stretch ends exactly
+    where the next one starts, places the stretches in `out` and fills in
+    the placeholders in order, and frees the job. If any stretch didn't
+    line up or failed, it decodes the whole stream serially instead, so
+    the result (status and output) is always that of cprs_decode();
+    `regionsUsed` gets the number of stretches used, 0 after a fallback.
+    The speculative stretches keep their output in buffers of their own
+    until then, so peak memory is about twice the output. */
+#define CPRS_PARALLEL_MIN_REGION 0x40000
+
+typedef struct cprs_parallel cprs_parallel;
+
+int cprs_parallel_begin(const void* in, size_t inLen, void* out, size_t outCap, size_t regions,
+                        cprs_parallel** job);
+size_t cprs_parallel_regions(const cprs_parallel* job);
+void cprs_parallel_decode(cprs_parallel* job, size_t region);
+int cprs_parallel_finish(cprs_parallel* job, size_t* outLen, size_t* regionsUsed);
+
+/*  Compression levels: CPRS_LEVEL_FAST is a greedy single-probe hash
+    matcher meant for quick repacks, CPRS_LEVEL_BEST an optimal parse for
+    the smallest output. The levels between trade speed for ratio. */
+#define CPRS_LEVEL_FAST     1
+#define CPRS_LEVEL_DEFAULT  6
+#define CPRS_LEVEL_BEST     9
+
+/*  Largest blob cprs_encode() can produce for `inLen` input bytes. */
+size_t cprs_encode_bound(size_t inLen);
+
+/*  Compresses `in` into a complete blob (header, bitstream, terminator and
+    trailing signature) that cprs_decode() turns back into `in`. `outCap`
+    of cprs_encode_bound(inLen) always suffices. The size of the blob is
+    stored in `outLen` (if non-null). Allocates its match tables, so it can
+    fail with CPRS_E_NOMEM; inputs whose sizes don't fit the 32-bit header
+    fields get CPRS_E_LARGE. */
+int cprs_encode(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen, int level);
+
+/*  Resumable decoder that takes input in arbitrary chunks and keeps only a
+    CPRS_WINDOW_SIZE ring of output, so memory use does not depend on the
+    size of the image.
+
+    cprs_stream_push() consumes input and decodes into the ring. It returns
+    CPRS_OK once all of `in` is consumed, CPRS_STREAM_FULL when the ring is
+    full of unpulled output (drain it with cprs_stream_pull() and push the
+    rest of the input again, even if that is nothing), CPRS_STREAM_END after
+    the terminator, or a negative error code. Errors are sticky until
+    cprs_stream_reset().
+
+    Only the leading signature is checked; the trailing one is never seen
+    because decoding stops at the terminator. */
+typedef struct cprs_stream cprs_stream;
+
+cprs_stream* cprs_stream_create(void);
+void cprs_stream_destroy(cprs_stream* stream);
+void cprs_stream_reset(cprs_stream* stream);
+
+int cprs_stream_push(cprs_stream* stream, const void* in, size_t inLen, size_t* inUsed);
+size_t cprs_stream_pull(cprs_stream* stream, void* out, size_t outCap);
+
+/*  Size fields of the stream's header, once enough input has been pushed. */
+int cprs_stream_header(const cprs_stream* stream, cprs_header* header);
+
+/*  Human readable description of a status code. */
+const char* cprs_strerror(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,461 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#include "cprs.h"
+
+/*  Decoder benchmark. With no files it builds a synthetic corpus (literal,
+    run and short-distance heavy streams, and the benchmark's own binary as
+    a real sample) through cprs_encode(); otherwise it times the given CPRS
+    blobs. Reports output MB/s, cycles per output byte and the token mix,
+    the time per token type as measured on the synthetic streams, and
+    optionally the same blobs through uncprs.py. */
+
+#define DEFAULT_ITERATIONS  20
+#define DEFAULT_SIZE        (4 << 20)
+
+typedef struct blob {
+    char name[64];
+    uint8_t* data;
+    size_t size;
+    cprs_header header;
+    cprs_stats stats;
+    double seconds;         /* best of all iterations */
+    double cycles;
+} blob;
+
+static int add_synthetic(blob* b, const char* name, char kind, size_t size);
+static int add_file(blob* b, const char* path, int encode);
+static int run(blob* b, int iterations, uint8_t* out);
+static double python_seconds(const char* script, const char* path);
+static double now(void);
+static uint64_t cycles(void);
+
+static uint32_t rng = 0x12345678;
+
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static int usage(char* argv0) {
+    fprintf(stderr, "Usage: %s [--iterations N] [--size BYTES] [--python UNCPRS_PY] [BLOB ...]\n", argv0);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    int iterations = DEFAULT_ITERATIONS;
+    size_t size = DEFAULT_SIZE;
+    char* python = 0;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-' && argv[argi][1] == '-'; ++argi) {
+        if (strcmp(argv[argi], "--iterations") == 0 && argi + 1 < argc) {
+            iterations = atoi(argv[++argi]);
+        } else if (strcmp(argv[argi], "--size") == 0 && argi + 1 < argc) {
+            size = strtoull(argv[++argi], 0, 0);
+        } else if (strcmp(argv[argi], "--python") == 0 && argi + 1 < argc) {
+            python = argv[++argi];
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (iterations < 1 || size == 0) {
+        return usage(argv[0]);
+    }
+
+    int synthetic = argi == argc;
+    size_t count = synthetic ? 5 : (size_t)(argc - argi);
+    blob* blobs = calloc(count, sizeof(blob));
+    if (!blobs) {
+        fprintf(stderr, "Error: Unable to allocate %zu blobs\n", count);
+        return 1;
+    }
+
+    int ok = 1;
+    if (synthetic) {
+        ok = add_synthetic(&blobs[0], "literal", 'l', size)
+            && add_synthetic(&blobs[1], "run", 'r', size)
+            && add_synthetic(&blobs[2], "short", 's', size)
+            && add_synthetic(&blobs[3], "mixed", 'm', size)
+            && add_file(&blobs[4], argv[0], 1);
+    } else {
+        for (size_t i = 0; ok && i < count; ++i) {
+            ok = add_file(&blobs[i], argv[argi + i], 0);
+        }
+    }
+
+    size_t outCap = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (blobs[i].data && blobs[i].header.decompressedSize > outCap) {
+            outCap = blobs[i].header.decompressedSize;
+        }
+    }
+    uint8_t* out = ok ? malloc(outCap ? outCap : 1) : 0;
+    if (ok && !out) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", outCap);
+        ok = 0;
+    }
+
+    if (ok) {
+        printf("decoder: %s\n\n", cprs_decode_isa());
+        printf("%-20s %10s %8s %9s %9s %6s %6s %6s %7s\n", "blob", "output", "ratio",
+               "MB/s", "cycles/B", "lit%", "run%", "match%", "ns/tok");
+    }
+    for (size_t i = 0; ok && i < count; ++i) {
+        blob* b = &blobs[i];
+        if (!run(b, iterations, out)) {
+            ok = 0;
+            break;
+        }
+
+        uint64_t tokens = b->stats.literalTokens + b->stats.runTokens + b->stats.matchTokens;
+        double perToken = tokens ? 100.0 / tokens : 0;
+        printf("%-20s %10u %8.3f %9.1f ", b->name, b->header.decompressedSize,
+               b->header.decompressedSize ? (double)b->size / b->header.decompressedSize : 0,
+               b->header.decompressedSize / b->seconds / 1e6);
+        if (b->cycles > 0) {
+            printf("%9.2f ", b->cycles / b->header.decompressedSize);
+        } else {
+            printf("%9s ", "-");
+        }
+        printf("%6.1f %6.1f %6.1f %7.2f\n", b->stats.literalTokens * perToken,
+               b->stats.runTokens * perToken, b->stats.matchTokens * perToken,
+               tokens ? b->seconds * 1e9 / tokens : 0);
+    }
+
+    /*  Each synthetic stream is one token type apart from its first few
+        literals, whose cost the literal stream gives. */
+    if (ok && synthetic) {
+        double literal = blobs[0].seconds / blobs[0].stats.literalTokens;
+        const cprs_stats* runs = &blobs[1].stats;
+        const cprs_stats* matches = &blobs[2].stats;
+
+        printf("\nper token type:\n");
+        printf("  literal %8.2f ns\n", literal * 1e9);
+        printf("  run     %8.2f ns  (%.1f bytes each)\n",
+               (blobs[1].seconds - literal * runs->literalTokens) / runs->runTokens * 1e9,
+               (double)runs->runBytes / runs->runTokens);
+        printf("  match   %8.2f ns  (%.1f bytes each, distance 2 to 16 bytes)\n",
+               (blobs[2].seconds - literal * matches->literalTokens) / matches->matchTokens * 1e9,
+               (double)matches->matchBytes / matches->matchTokens);
+    }
+
+    if (ok && python) {
+        printf("\n%-20s %9s %9s %9s\n", "blob", "C MB/s", "py MB/s", "speedup");
+        char path[] = "/tmp/cprs_bench_XXXXXX";
+        for (size_t i = 0; ok && i < count; ++i) {
+            blob* b = &blobs[i];
+            int fd = mkstemp(path);
+            FILE* file = fd >= 0 ? fdopen(fd, "wb") : 0;
+            if (!file || fwrite(b->data, 1, b->size, file) != b->size) {
+                fprintf(stderr, "Error: Unable to write %s\n", path);
+                if (file) {
+                    fclose(file);
+                }
+                ok = 0;
+                break;
+            }
+            fclose(file);
+
+            double seconds = python_seconds(python, path);
+            remove(path);
+            strcpy(path + strlen(path) - 6, "XXXXXX");
+            if (seconds <= 0) {
+                fprintf(stderr, "Error: %s failed on %s\n", python, b->name);
+                ok = 0;
+                break;
+            }
+            printf("%-20s %9.1f %9.2f %8.0fx\n", b->name,
+                   b->header.decompressedSize / b->seconds / 1e6,
+                   b->header.decompressedSize / seconds / 1e6, seconds / b->seconds);
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        free(blobs[i].data);
+    }
+    free(blobs);
+    free(out);
+    return ok ? 0 : 1;
+}
+
+/*  Bit writer for the synthetic streams. */
+typedef struct writer {
+    uint8_t* out;
+    size_t words;
+    uint64_t bits;
+    uint32_t count;
+} writer;
+
+static void put_bits(writer* w, uint32_t value, uint32_t count) {
+    w->bits |= (uint64_t)value << w->count;
+    w->count += count;
+    if (w->count >= 32) {
+        uint8_t* p = w->out + 12 + 4 * w->words++;
+        p[0] = (uint8_t)w->bits;
+        p[1] = (uint8_t)(w->bits >> 8);
+        p[2] = (uint8_t)(w->bits >> 16);
+        p[3] = (uint8_t)(w->bits >> 24);
+        w->bits >>= 32;
+        w->count -= 32;
+    }
+}
+
+/*  Match of `length` (2 to 269) at a distance of under 516 halfwords. */
+static void put_match(writer* w, uint32_t length, uint32_t distance) {
+    uint32_t field = length - 2;
+    uint32_t group = field < 2 ? 0 : field < 4 ? 1 : field < 12 ? 2 : 3;
+    static const uint32_t base[4] = { 0, 2, 4, 12 };
+    static const uint32_t bits[4] = { 1, 1, 3, 8 };
+    put_bits(w, 1 | group << 1, 3);
+    put_bits(w, field - base[group], bits[group]);
+
+    uint32_t code = 3;
+    if (distance < 12) {
+        put_bits(w, distance >> 2, 4);
+        put_bits(w, distance & 3, 2);
+        return;
+    }
+    while (distance - 4 >= 2u << code) {
+        ++code;
+    }
+    put_bits(w, code, 4);
+    put_bits(w, distance - (1u << code) - 4, code);
+}
+
+/*  Streams made of a single token type (after a few leading literals):
+    'l' literals, 'r' runs, 's' matches at distances of up to 8 halfwords.
+    'm' is mixed data packed with the fast encoder instead. */
+static int add_synthetic(blob* b, const char* name, char kind, size_t size) {
+    snprintf(b->name, sizeof(b->name), "%s", name);
+
+    if (kind == 'm') {
+        uint8_t* raw = malloc(size);
+        if (!raw) {
+            fprintf(stderr, "Error: Unable to allocate %zu bytes\n", size);
+            return 0;
+        }
+        for (size_t i = 0; i < size; ) {
+            uint32_t r = next_random();
+            size_t n = r >> 30 == 0 ? 1 + (r & 63) : 4 + (r >> 8 & 255);
+            for (size_t j = 0; j < n && i + j < size; ++j) {
+                uint32_t period = 2 * (1 + (r & 7));
+                raw[i + j] = r >> 30 == 0 || j < period || i + j < period
+                    ? (uint8_t)next_random()
+                    : r >> 30 == 1 ? raw[i + j - 1] : raw[i + j - period];
+            }
+            i += n;
+        }
+
+        int ok = 0;
+        size_t cap = cprs_encode_bound(size);
+        b->data = malloc(cap);
+        if (b->data && cprs_encode(raw, size, b->data, cap, &b->size, CPRS_LEVEL_FAST) == CPRS_OK) {
+            ok = cprs_header_peek(b->data, b->size, &b->header) == CPRS_OK;
+        }
+        free(raw);
+        if (!ok) {
+            fprintf(stderr, "Error: Unable to build the %s stream\n", name);
+        }
+        return ok;
+    }
+
+    /*  No token is shorter than 9 bits or yields less than a byte. */
+    size_t cap = 24 + size / 8 * 9 + 64;
+    writer w = { malloc(cap), 0, 0, 0 };
+    if (!w.out) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", cap);
+        return 0;
+    }
+    b->data = w.out;
+
+    size_t produced = 0;
+    while (produced < (kind == 'l' ? size : 16)) {
+        put_bits(&w, (next_random() & 0xff) << 1, 9);
+        ++produced;
+    }
+    while (produced < size) {
+        uint32_t r = next_random();
+        uint32_t length = 2 + r % 268;
+        if (length > size - produced) {
+            length = size - produced < 2 ? 2 : (uint32_t)(size - produced);
+        }
+        put_match(&w, length, kind == 'r' ? 0 : 1 + (r >> 16) % 8);
+        produced += length;
+    }
+
+    /*  Terminator, padding to whole words (at least two) and framing. */
+    put_bits(&w, 1, 4);
+    put_bits(&w, 15, 4);
+    put_bits(&w, 0x7fff, 15);
+    if (w.count) {
+        put_bits(&w, 0, 32 - w.count);
+    }
+    while (w.words < 2) {
+        put_bits(&w, 0, 32);
+    }
+
+    b->size = 16 + 4 * w.words;
+    uint32_t fields[3] = { CPRS_SIG, (uint32_t)b->size, (uint32_t)produced };
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            w.out[4 * i + j] = (uint8_t)(fields[i] >> 8 * j);
+        }
+    }
+    memcpy(w.out + b->size - 4, w.out, 4);
+
+    return cprs_header_peek(b->data, b->size, &b->header) == CPRS_OK;
+}
+
+/*  A CPRS blob from disk, or (with `encode`) any file packed at the
+    default level. */
+static int add_file(blob* b, const char* path, int encode) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: Unable to open file %s\n", path);
+        return 0;
+    }
+
+    uint8_t* data = 0;
+    size_t size = 0;
+    size_t cap = 0;
+    size_t bytesRead;
+    do {
+        if (size == cap) {
+            cap = cap ? cap * 2 : 0x10000;
+            uint8_t* grown = realloc(data, cap);
+            if (!grown) {
+                fprintf(stderr, "Error: Unable to allocate %zu bytes\n", cap);
+                free(data);
+                fclose(file);
+                return 0;
+            }
+            data = grown;
+        }
+        bytesRead = fread(data + size, 1, cap - size, file);
+        size += bytesRead;
+    } while (bytesRead != 0);
+    fclose(file);
+
+    const char* base = strrchr(path, '/');
+    snprintf(b->name, sizeof(b->name), "%s", base ? base + 1 : path);
+
+    if (encode) {
+        size_t bound = cprs_encode_bound(size);
+        b->data = malloc(bound);
+        int status = b->data ? cprs_encode(data, size, b->data, bound, &b->size, CPRS_LEVEL_DEFAULT) : CPRS_E_NOMEM;
+        free(data);
+        if (status != CPRS_OK) {
+            fprintf(stderr, "Error: %s: %s\n", path, cprs_strerror(status));
+            return 0;
+        }
+    } else {
+        b->data = data;
+        b->size = size;
+    }
+
+    int status = cprs_header_peek(b->data, b->size, &b->header);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s: %s\n", path, cprs_strerror(status));
+        return 0;
+    }
+    return 1;
+}
+
+static int run(blob* b, int iterations, uint8_t* out) {
+    size_t outLen;
+    int status = cprs_decode_stats(b->data, b->size, out, b->header.decompressedSize, &outLen, &b->stats);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s: %s\n", b->name, cprs_strerror(status));
+        return 0;
+    }
+
+    b->seconds = 0;
+    b->cycles = 0;
+    for (int i = 0; i < iterations; ++i) {
+        uint64_t startCycles = cycles();
+        double start = now();
+        cprs_decode(b->data, b->size, out, b->header.decompressedSize, &outLen);
+        double seconds = now() - start;
+        double elapsed = (double)(cycles() - startCycles);
+        if (i == 0 || seconds < b->seconds) {
+            b->seconds = seconds;
+            b->cycles = elapsed;
+        }
+    }
+    if (b->seconds <= 0) {
+        b->seconds = 1e-9;
+    }
+    return 1;
+}
+
+/*  Time uncprs.py's pure-Python decoder takes on the blob at `path`,
+    measured inside the interpreter so start-up isn't counted. */
+static double python_seconds(const char* script, const char* path) {
+    char dir[4096];
+    const char* slash = strrchr(script, '/');
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - script) : 1, slash ? script : ".");
+
+    char command[8192 + 512];
+    snprintf(command, sizeof(command),
+             "python3 -c 'import sys, time; sys.path.insert(0, sys.argv[1]); import uncprs; "
+             "f = getattr(uncprs, \"decompress_python\", uncprs.decompress); "
+             "d = open(sys.argv[2], \"rb\").read(); t = time.perf_counter(); f(d); "
+             "print(time.perf_counter() - t)' '%s' '%s'", dir, path);
+
+    FILE* pipe = popen(command, "r");
+    if (!pipe) {
+        return 0;
+    }
+    double seconds = 0;
+    if (fscanf(pipe, "%lf", &seconds) != 1) {
+        seconds = 0;
+    }
+    pclose(pipe);
+    return seconds;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*  Time-stamp counter where there is one, which on current x86 parts
+    ticks at the nominal clock rather than the actual one. */
+static uint64_t cycles(void) {
+#ifdef HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,319 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*  The one-shot decode loop, included once per variant with CORE_NAME set
+    to the function to define and CORE_STATS selecting whether the
+    cprs_stats counters are compiled in. With CORE_STATS 0 the loop holds
+    no trace of them. Likewise CORE_RANGE starts and stops the loop where
+    the cprs_span says and CORE_INDEX records checkpoints into it.
+    CORE_HEAD treats the end of the output buffer as the end of the
+    stream, cutting the last token short to fit, and CORE_TRACE records
+    every token through trace_token(), which the includer defines.
+    CORE_INPLACE is for output that runs up the same buffer towards the
+    input: it stops with CPRS_E_SPACE before a token could write over
+    input that hasn't been read yet. CORE_SPLIT, on top of CORE_RANGE, also
+    stops at the first token boundary at or past the span's stopBit. */
+
+#ifndef CORE_RANGE
+#define CORE_RANGE 0
+#endif
+
+#ifndef CORE_INDEX
+#define CORE_INDEX 0
+#endif
+
+#ifndef CORE_HEAD
+#define CORE_HEAD 0
+#endif
+
+#ifndef CORE_TRACE
+#define CORE_TRACE 0
+#endif
+
+#ifndef CORE_INPLACE
+#define CORE_INPLACE 0
+#endif
+
+#ifndef CORE_SPLIT
+#define CORE_SPLIT 0
+#endif
+
+#if CORE_STATS
+#define STAT(expr) (expr)
+#else
+#define STAT(expr) ((void)0)
+#endif
+
+#define STAT_BUCKET(value) (31 - cprs_clz32((uint32_t)(value) | 1))
+
+/*  Per-token bookkeeping of the range and index variants, run at every
+    token boundary. */
+#if CORE_RANGE && CORE_SPLIT
+#define CORE_STOP()                                                            \
+    if (op >= stop || bits_position(&br, data + 12) >= span->stopBit) {        \
+        span->bitPos = bits_position(&br, data + 12);                          \
+        break;                                                                 \
+    }
+#elif CORE_RANGE
+#define CORE_STOP()                                                            \
+    if (op >= stop) {                                                          \
+        span->bitPos = bits_position(&br, data + 12);                          \
+        break;                                                                 \
+    }
+#else
+#define CORE_STOP()
+#endif
+
+#if CORE_INDEX
+#define CORE_CHECKPOINT()                                                      \
+    if ((size_t)(op - out) >= nextMark && span->count < span->capacity) {      \
+        uint8_t* entry = span->entries + span->count++ * CPRS_INDEX_ENTRY_SIZE;\
+        uint64_t bitPos = bits_position(&br, data + 12);                       \
+        store32le(entry, (uint32_t)bitPos);                                    \
+        store32le(entry + 4, (uint32_t)(bitPos >> 32));                        \
+        store32le(entry + 8, (uint32_t)(op - out));                            \
+        nextMark = (op - out) / span->interval * span->interval + span->interval;\
+    }
+#else
+#define CORE_CHECKPOINT()
+#endif
+
+/*  Everything from br.ptr on is still to be read, and no token writes
+    further than this past `op`. */
+#if CORE_INPLACE
+#define CORE_GUARD()                                                           \
+    if (br.ptr - op < (ptrdiff_t)(CPRS_MAX_TOKEN_OUTPUT + COPY_SLACK)) {       \
+        status = CPRS_E_SPACE;                                                 \
+        goto done;                                                             \
+    }
+#else
+#define CORE_GUARD()
+#endif
+
+/*  CORE_TRACE keeps the bits and position of the token being decoded and
+    records it as soon as it is known, before it is checked. */
+#if CORE_TRACE
+#define TRACE_BEGIN()                                                          \
+    const uint64_t traceBits = br.bits;                                        \
+    const uint64_t tracePos = bits_position(&br, data + 12);
+#define TRACE(kind, length, distance)                                          \
+    if (!trace_token(span, traceBits, tracePos, (kind), (length), (distance), op - out)) {\
+        status = CPRS_E_TRACE;                                                 \
+        goto done;                                                             \
+    }
+#define TRACE_MATCH(length, distance)                                          \
+    TRACE((distance) >= CPRS_TERM ? CPRS_TRACE_END                             \
+          : (distance) ? CPRS_TRACE_MATCH : CPRS_TRACE_RUN, length, distance)
+#else
+#define TRACE_BEGIN()
+#define TRACE(kind, length, distance)
+#define TRACE_MATCH(length, distance)
+#endif
+
+/*  Decodes into out[0, outCap) and stores the number of bytes written in
+    `outLen`. Every back-reference is checked against the start of the
+    output and nothing is read or written out of bounds, whatever the
+    bitstream holds: a stream that would run past either buffer gets
+    CPRS_E_TRUNC (out of input) or CPRS_E_CORRUPT (anything else). */
+static int CORE_NAME(const uint8_t* data, size_t inLen, uint8_t* out, size_t outCap, size_t* outLen,
+                     cprs_stats* stats, cprs_span* span) {
+    uint8_t* const outEnd = out + outCap;
+    uint8_t* op = out;
+    int status = CPRS_OK;
+
+    cprs_bits br;
+#if CORE_RANGE
+    bits_seek(&br, data + 12, data + inLen, span->bitPos);
+    op += span->outPos;
+    uint8_t* const stop = out + span->stop;
+#else
+    bits_init(&br, data + 12, data + inLen);
+#endif
+#if CORE_INDEX
+    size_t nextMark = 0;
+#endif
+
+    /*  It's just a tidied up decompilation of the decompression
+        function found in the internal flash of a Seagate/LSI MCU,
+        split into two loops.
+
+        The first runs while there are at least 8 bytes of input left to
+        refill from and room for the largest token's output, copy slack
+        included, so the only check left in it is the back-reference
+        distance. The second takes over for the last stretch of either
+        buffer and checks every token.
+     */
+
+    uint8_t writeCarryByte = op > out ? op[-1] : 0;
+
+    const uint8_t* const inFast = inLen >= 12 + 8 ? data + inLen - 8 : data;
+    uint8_t* const outFast = outCap >= CPRS_MAX_TOKEN_OUTPUT + COPY_SLACK
+        ? outEnd - (CPRS_MAX_TOKEN_OUTPUT + COPY_SLACK)
+        : out;
+
+    (void)stats;
+    (void)span;
+
+    while (op < outFast && br.ptr <= inFast) {
+        CORE_STOP()
+        CORE_CHECKPOINT()
+        CORE_GUARD()
+
+        if (br.count < CPRS_MAX_TOKEN_BITS) {
+            STAT(stats->refills += 1);
+            bits_refill(&br);
+        }
+        TRACE_BEGIN()
+
+        uint32_t entry = CPRS_LUT[br.bits & CPRS_LUT_MASK];
+
+        if (!(entry & CPRS_LUT_MATCH)) {
+            STAT(stats->literalTokens += 1);
+            writeCarryByte = lut_value(entry);
+            bits_consume(&br, 9);
+            TRACE(CPRS_TRACE_LITERAL, writeCarryByte, 0)
+            *op++ = writeCarryByte;
+            continue;
+        }
+
+        uint32_t length;
+        uint32_t distance;
+        bits_consume(&br, decode_match(br.bits, entry, &length, &distance));
+        TRACE_MATCH(length, distance)
+
+        if (distance >= CPRS_TERM) {
+            goto done;
+        }
+
+        if (distance == 0) {
+            STAT(stats->runTokens += 1);
+            STAT(stats->runBytes += length);
+            STAT(stats->lengths[STAT_BUCKET(length)] += 1);
+            op = fill_run(op, length, writeCarryByte, outEnd);
+        } else {
+            if (distance * 2 > (size_t)(op - out)) {
+                status = CPRS_E_CORRUPT;
+                goto done;
+            }
+            STAT(stats->matchTokens += 1);
+            STAT(stats->matchBytes += length);
+            STAT(stats->lengths[STAT_BUCKET(length)] += 1);
+            STAT(stats->distances[STAT_BUCKET(distance * 2)] += 1);
+            op = copy_match(op, length, distance * 2, outEnd);
+            writeCarryByte = op[-1];
+        }
+    }
+
+    while (1) {
+        CORE_STOP()
+        CORE_CHECKPOINT()
+        CORE_GUARD()
+#if CORE_HEAD
+        if (op == outEnd) {
+            break;
+        }
+#endif
+
+        if (br.count < CPRS_MAX_TOKEN_BITS) {
+            STAT(stats->refills += 1);
+            if (br.end - br.ptr >= 8) {
+                bits_refill(&br);
+            } else {
+                bits_refill_tail(&br);
+            }
+        }
+        TRACE_BEGIN()
+
+        uint32_t entry = CPRS_LUT[br.bits & CPRS_LUT_MASK];
+
+        if (!(entry & CPRS_LUT_MATCH)) {
+            bits_consume(&br, 9);
+            TRACE(CPRS_TRACE_LITERAL, lut_value(entry), 0)
+            if (br.padding > br.count) {
+                status = CPRS_E_TRUNC;
+                break;
+            }
+            if (op == outEnd) {
+                status = CPRS_E_CORRUPT;
+                break;
+            }
+            STAT(stats->literalTokens += 1);
+            writeCarryByte = lut_value(entry);
+            *op++ = writeCarryByte;
+            continue;
+        }
+
+        uint32_t length;
+        uint32_t distance;
+        bits_consume(&br, decode_match(br.bits, entry, &length, &distance));
+        TRACE_MATCH(length, distance)
+
+        if (br.padding > br.count) {
+            status = CPRS_E_TRUNC;
+            break;
+        }
+
+        if (distance >= CPRS_TERM) {
+            break;
+        }
+
+#if CORE_HEAD
+        if (length > (size_t)(outEnd - op)) {
+            length = (uint32_t)(outEnd - op);
+        }
+#endif
+        if (length > (size_t)(outEnd - op) || distance * 2 > (size_t)(op - out)) {
+            status = CPRS_E_CORRUPT;
+            break;
+        }
+
+        if (distance == 0) {
+            STAT(stats->runTokens += 1);
+            STAT(stats->runBytes += length);
+            STAT(stats->lengths[STAT_BUCKET(length)] += 1);
+            op = fill_run(op, length, writeCarryByte, outEnd);
+        } else {
+            STAT(stats->matchTokens += 1);
+            STAT(stats->matchBytes += length);
+            STAT(stats->lengths[STAT_BUCKET(length)] += 1);
+            STAT(stats->distances[STAT_BUCKET(distance * 2)] += 1);
+            op = copy_match(op, length, distance * 2, outEnd);
+            writeCarryByte = op[-1];
+        }
+    }
+
+done:
+    *outLen = op - out;
+    return status;
+}
+
+#undef CORE_STOP
+#undef CORE_CHECKPOINT
+#undef CORE_GUARD
+#undef TRACE_BEGIN
+#undef TRACE
+#undef TRACE_MATCH
+#undef STAT
+#undef STAT_BUCKET
+#undef CORE_NAME
+#undef CORE_STATS
+#undef CORE_RANGE
+#undef CORE_INDEX
+#undef CORE_HEAD
+#undef CORE_TRACE
+#undef CORE_INPLACE
+#undef CORE_SPLIT
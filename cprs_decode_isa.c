@@ -0,0 +1,40 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*  The plain decode loop once more, for the runtime dispatch in cprs.c.
+    The Makefile compiles this file once per instruction set, each time
+    with that set's -m flags and CPRS_ISA_ENTRY naming the function, so
+    the helpers in cprs_internal.h pick their vector paths (and the
+    compiler its instructions) for that target. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "cprs_internal.h"
+
+#ifndef CPRS_ISA_ENTRY
+#error "CPRS_ISA_ENTRY must name the variant"
+#endif
+
+#define CORE_NAME decode_isa
+#define CORE_STATS 0
+#include "cprs_decode_core.h"
+
+int CPRS_ISA_ENTRY(const uint8_t* data, size_t inLen, uint8_t* out, size_t outCap, size_t* outLen) {
+    return decode_isa(data, inLen, out, outCap, outLen, 0, 0);
+}
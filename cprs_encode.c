@@ -0,0 +1,528 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CPRS_NO_LUT
+#include "cprs.h"
+#include "cprs_internal.h"
+
+/*  Encoder for the token format the decoder reads, see cprs.h and
+    CPRS_TABLE. A match is a length and a distance in halfwords, so apart
+    from distance 0 (repeat the previous byte) the source has to be an
+    even number of bytes back. The hash chains are kept per parity of the
+    position for that reason: every candidate they turn up is usable.
+
+    Level 1 is greedy with a single probe, 2 to 8 walk longer chains and
+    look one byte ahead before taking a match, 9 finds the cheapest parse
+    of each block with a shortest-path pass over the candidate matches. */
+
+#define HASH_BITS   16
+#define HASH_SIZE   (1 << HASH_BITS)
+
+/*  Ring of chain links, larger than the window so nothing still reachable
+    is overwritten. */
+#define CHAIN_SIZE  (1 << 18)
+#define CHAIN_MASK  (CHAIN_SIZE - 1)
+
+#define HASH_BYTES  3
+
+/*  Lengths a match token can carry: 0..267 extra on top of 2, or 3 for
+    distance codes from 9 up. */
+#define LENGTH_RANGE    268
+#define MAX_LENGTH      (LENGTH_RANGE + 2)
+
+#define MAX_DISTANCE    (CPRS_TERM - 1)
+
+#define LITERAL_BITS    9
+
+/*  Positions per optimal parse pass. */
+#define PARSE_BLOCK     0x10000
+
+#define MAX_CANDIDATES  64
+
+typedef struct level_params {
+    uint32_t depth;
+    uint32_t nice;
+} level_params;
+
+static const level_params LEVELS[CPRS_LEVEL_BEST + 1] = {
+    {   0,   0 },
+    {   1,  16 },
+    {   4,  16 },
+    {   8,  32 },
+    {  16,  32 },
+    {  32,  64 },
+    {  64, 128 },
+    { 128, 128 },
+    { 256, MAX_LENGTH },
+    { 256, MAX_LENGTH },
+};
+
+typedef struct bit_writer {
+    uint8_t* out;
+    size_t words;
+    size_t capWords;
+    uint64_t bits;
+    uint32_t count;
+} bit_writer;
+
+typedef struct match {
+    uint32_t length;
+    uint32_t distance;  /* halfwords, 0 for a run of the previous byte */
+} match;
+
+typedef struct encoder {
+    const uint8_t* in;
+    uint32_t inLen;
+    level_params params;
+    uint32_t head[2 * HASH_SIZE];
+    uint32_t chain[CHAIN_SIZE];
+} encoder;
+
+typedef struct parse_node {
+    uint32_t price;
+    uint32_t length;
+    uint32_t distance;
+} parse_node;
+
+static void encode_lazy(encoder* e, bit_writer* bw, int lazy);
+static int encode_optimal(encoder* e, bit_writer* bw);
+static uint32_t find_matches(encoder* e, uint32_t pos, match* found);
+static match best_match(encoder* e, uint32_t pos);
+static void insert(encoder* e, uint32_t pos);
+static uint32_t match_bits(uint32_t length, uint32_t distance);
+static uint32_t length_extra_bits(uint32_t lengthField);
+static uint32_t common_length(const uint8_t* a, const uint8_t* b, uint32_t limit);
+static uint32_t distance_code(uint32_t distance, uint32_t* extraBits, uint32_t* base);
+static uint32_t max_length(uint32_t distance);
+static void put_bits(bit_writer* bw, uint32_t value, uint32_t count);
+static void put_literal(bit_writer* bw, uint8_t value);
+static void put_match(bit_writer* bw, uint32_t length, uint32_t distance);
+
+size_t cprs_encode_bound(size_t inLen) {
+    /*  All literals, the terminator and the word padding. */
+    size_t words = (inLen / 32) * LITERAL_BITS + ((inLen % 32) * LITERAL_BITS + 23 + 31) / 32;
+    return CPRS_HEADER_SIZE - 4 + 4 * (words < 2 ? 2 : words);
+}
+
+int cprs_encode(const void* in, size_t inLen, void* out, size_t outCap, size_t* outLen, int level) {
+    if (inLen > UINT32_MAX || cprs_encode_bound(inLen) > UINT32_MAX) {
+        return CPRS_E_LARGE;
+    }
+
+    if (outCap < CPRS_HEADER_SIZE) {
+        return CPRS_E_SPACE;
+    }
+
+    if (level < CPRS_LEVEL_FAST) {
+        level = CPRS_LEVEL_FAST;
+    } else if (level > CPRS_LEVEL_BEST) {
+        level = CPRS_LEVEL_BEST;
+    }
+
+    encoder* e = malloc(sizeof(encoder));
+    if (!e) {
+        return CPRS_E_NOMEM;
+    }
+    e->in = in;
+    e->inLen = (uint32_t)inLen;
+    e->params = LEVELS[level];
+    memset(e->head, 0xff, sizeof(e->head));
+
+    uint8_t* data = out;
+    bit_writer bw = { data + 12, 0, (outCap - CPRS_HEADER_SIZE + 4) / 4, 0, 0 };
+
+    int status = CPRS_OK;
+    if (level == CPRS_LEVEL_BEST) {
+        status = encode_optimal(e, &bw);
+    } else {
+        encode_lazy(e, &bw, level > CPRS_LEVEL_FAST);
+    }
+    free(e);
+
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    /*  Terminator: the shortest length and a distance past the window. */
+    put_bits(&bw, 1, 1);
+    put_bits(&bw, 0, 3);
+    put_bits(&bw, 15, 4);
+    put_bits(&bw, 0x7fff, 15);
+    if (bw.count > 0) {
+        put_bits(&bw, 0, 32 - bw.count);
+    }
+
+    /*  The decoder starts out with two whole words. */
+    while (bw.words < 2) {
+        put_bits(&bw, 0, 32);
+    }
+
+    if (bw.words > bw.capWords) {
+        return CPRS_E_SPACE;
+    }
+
+    size_t size = CPRS_HEADER_SIZE - 4 + 4 * bw.words;
+    store32le(data, CPRS_SIG);
+    store32le(data + 4, (uint32_t)size);
+    store32le(data + 8, (uint32_t)inLen);
+    store32le(data + size - 4, CPRS_SIG);
+
+    if (outLen) {
+        *outLen = size;
+    }
+    return CPRS_OK;
+}
+
+/*  Greedy parse, optionally deferring a match by one byte when the match
+    starting there saves more. */
+static void encode_lazy(encoder* e, bit_writer* bw, int lazy) {
+    uint32_t pos = 0;
+    match current = best_match(e, 0);
+    insert(e, 0);
+
+    while (pos < e->inLen) {
+        if (current.length == 0) {
+            put_literal(bw, e->in[pos++]);
+            current = best_match(e, pos);
+            insert(e, pos);
+            continue;
+        }
+
+        uint32_t hashed = pos + 1;
+        if (lazy && current.length < e->params.nice) {
+            match next = best_match(e, pos + 1);
+            insert(e, pos + 1);
+            ++hashed;
+            if (next.length > 0 && LITERAL_BITS * next.length - match_bits(next.length, next.distance)
+                    > LITERAL_BITS * current.length - match_bits(current.length, current.distance)) {
+                put_literal(bw, e->in[pos++]);
+                current = next;
+                continue;
+            }
+        }
+
+        put_match(bw, current.length, current.distance);
+        uint32_t end = pos + current.length;
+        for (uint32_t p = hashed; p < end; ++p) {
+            insert(e, p);
+        }
+        pos = end;
+        current = best_match(e, pos);
+        insert(e, pos);
+    }
+}
+
+/*  Cheapest parse in bits of each PARSE_BLOCK positions. Matches are cut
+    at the end of the block, which costs a little at every boundary but
+    keeps the tables bounded. */
+static int encode_optimal(encoder* e, bit_writer* bw) {
+    parse_node* nodes = malloc((PARSE_BLOCK + 1) * sizeof(parse_node));
+    match* path = malloc(PARSE_BLOCK * sizeof(match));
+    if (!nodes || !path) {
+        free(nodes);
+        free(path);
+        return CPRS_E_NOMEM;
+    }
+
+    for (uint32_t blockStart = 0; blockStart < e->inLen; ) {
+        uint32_t blockLen = e->inLen - blockStart;
+        if (blockLen > PARSE_BLOCK) {
+            blockLen = PARSE_BLOCK;
+        }
+
+        nodes[0].price = 0;
+        for (uint32_t i = 1; i <= blockLen; ++i) {
+            nodes[i].price = UINT32_MAX;
+        }
+
+        /*  Inside a match at least `nice` long the candidates aren't
+            worth looking for; those positions only get hashed. */
+        uint32_t skipUntil = 0;
+
+        for (uint32_t i = 0; i < blockLen; ++i) {
+            uint32_t pos = blockStart + i;
+            uint32_t price = nodes[i].price;
+
+            if (price + LITERAL_BITS < nodes[i + 1].price) {
+                nodes[i + 1].price = price + LITERAL_BITS;
+                nodes[i + 1].length = 1;
+                nodes[i + 1].distance = 0;
+            }
+
+            if (i < skipUntil) {
+                insert(e, pos);
+                continue;
+            }
+
+            match found[MAX_CANDIDATES + 1];
+            uint32_t count = find_matches(e, pos, found);
+            insert(e, pos);
+
+            /*  Lengths grow down the list and distances (so costs) with
+                them, so each length is priced with the first candidate
+                that reaches it. */
+            uint32_t covered = 1;
+            for (uint32_t k = 0; k < count; ++k) {
+                uint32_t length = found[k].length;
+                uint32_t distance = found[k].distance;
+                if (length > blockLen - i) {
+                    length = blockLen - i;
+                }
+
+                uint32_t extraBits;
+                uint32_t base;
+                uint32_t minimum = distance_code(distance, &extraBits, &base) >= 9 ? 3 : 2;
+                if (length > minimum + LENGTH_RANGE - 1) {
+                    length = minimum + LENGTH_RANGE - 1;
+                }
+                uint32_t fixed = price + 1 + 2 + 4 + extraBits;
+
+                for (uint32_t l = covered + 1 > minimum ? covered + 1 : minimum; l <= length; ++l) {
+                    uint32_t cost = fixed + length_extra_bits(l - minimum);
+                    if (cost < nodes[i + l].price) {
+                        nodes[i + l].price = cost;
+                        nodes[i + l].length = l;
+                        nodes[i + l].distance = distance;
+                    }
+                }
+                if (length > covered) {
+                    covered = length;
+                }
+            }
+
+            if (covered >= e->params.nice) {
+                skipUntil = i + covered;
+            }
+        }
+
+        uint32_t steps = 0;
+        for (uint32_t i = blockLen; i > 0; i -= nodes[i].length) {
+            path[steps].length = nodes[i].length;
+            path[steps].distance = nodes[i].distance;
+            ++steps;
+        }
+
+        uint32_t pos = blockStart;
+        while (steps-- > 0) {
+            if (path[steps].length == 1) {
+                put_literal(bw, e->in[pos]);
+            } else {
+                put_match(bw, path[steps].length, path[steps].distance);
+            }
+            pos += path[steps].length;
+        }
+
+        blockStart += blockLen;
+    }
+
+    free(nodes);
+    free(path);
+    return CPRS_OK;
+}
+
+/*  Candidate matches at `pos`, longest-so-far only, so both length and
+    distance increase along the list. A run of the previous byte comes
+    first as distance 0. */
+static uint32_t find_matches(encoder* e, uint32_t pos, match* found) {
+    const uint8_t* in = e->in;
+    uint32_t limit = e->inLen - pos;
+    if (limit > MAX_LENGTH) {
+        limit = MAX_LENGTH;
+    }
+
+    uint32_t count = 0;
+    uint32_t best = 1;
+
+    if (pos > 0) {
+        uint8_t previous = in[pos - 1];
+        uint32_t length = 0;
+        while (length < limit && in[pos + length] == previous) {
+            ++length;
+        }
+        if (length > best) {
+            found[count].length = length;
+            found[count].distance = 0;
+            ++count;
+            best = length;
+        }
+    }
+
+    if (limit < HASH_BYTES || best >= limit) {
+        return count;
+    }
+
+    uint32_t h = ((uint32_t)in[pos] | (uint32_t)in[pos + 1] << 8 | (uint32_t)in[pos + 2] << 16) * 2654435761u;
+    uint32_t candidate = e->head[(h >> (32 - HASH_BITS)) << 1 | (pos & 1)];
+
+    for (uint32_t depth = e->params.depth; depth > 0 && candidate < pos; --depth) {
+        uint32_t distance = (pos - candidate) / 2;
+        if (distance > MAX_DISTANCE) {
+            break;
+        }
+
+        if (in[candidate + best] == in[pos + best]) {
+            uint32_t length = common_length(in + candidate, in + pos, limit);
+            if (length > best) {
+                found[count].length = length;
+                found[count].distance = distance;
+                ++count;
+                best = length;
+                if (best >= limit || best >= e->params.nice || count == MAX_CANDIDATES) {
+                    break;
+                }
+            }
+        }
+
+        uint32_t next = e->chain[candidate & CHAIN_MASK];
+        if (next >= candidate) {
+            break;
+        }
+        candidate = next;
+    }
+    return count;
+}
+
+/*  The candidate at `pos` that saves the most bits over literals, or a
+    zero length if none saves any. */
+static match best_match(encoder* e, uint32_t pos) {
+    match none = { 0, 0 };
+    if (pos >= e->inLen) {
+        return none;
+    }
+
+    match found[MAX_CANDIDATES + 1];
+    uint32_t count = find_matches(e, pos, found);
+
+    match best = none;
+    uint32_t bestSaving = 0;
+    for (uint32_t k = 0; k < count; ++k) {
+        uint32_t length = found[k].length;
+        uint32_t limit = max_length(found[k].distance);
+        if (length > limit) {
+            length = limit;
+        }
+        if (length + LENGTH_RANGE <= limit) {
+            continue;
+        }
+        uint32_t bits = match_bits(length, found[k].distance);
+        if (LITERAL_BITS * length > bits + bestSaving) {
+            bestSaving = LITERAL_BITS * length - bits;
+            best.length = length;
+            best.distance = found[k].distance;
+        }
+    }
+    return best;
+}
+
+static void insert(encoder* e, uint32_t pos) {
+    if (pos + HASH_BYTES > e->inLen) {
+        return;
+    }
+    const uint8_t* in = e->in;
+    uint32_t h = ((uint32_t)in[pos] | (uint32_t)in[pos + 1] << 8 | (uint32_t)in[pos + 2] << 16) * 2654435761u;
+    uint32_t* slot = &e->head[(h >> (32 - HASH_BITS)) << 1 | (pos & 1)];
+    e->chain[pos & CHAIN_MASK] = *slot;
+    *slot = pos;
+}
+
+/*  Number of leading bytes `a` and `b` have in common, up to `limit`. */
+static uint32_t common_length(const uint8_t* a, const uint8_t* b, uint32_t limit) {
+    uint32_t length = 0;
+#if defined(__GNUC__)
+    while (length + 8 <= limit) {
+        uint64_t x = load64le(a + length) ^ load64le(b + length);
+        if (x != 0) {
+            return length + (__builtin_ctzll(x) >> 3);
+        }
+        length += 8;
+    }
+#endif
+    while (length < limit && a[length] == b[length]) {
+        ++length;
+    }
+    return length;
+}
+
+static uint32_t max_length(uint32_t distance) {
+    uint32_t extraBits;
+    uint32_t base;
+    return (distance_code(distance, &extraBits, &base) >= 9 ? 3 : 2) + LENGTH_RANGE - 1;
+}
+
+static uint32_t length_extra_bits(uint32_t lengthField) {
+    return lengthField < 4 ? 1 : lengthField < 12 ? 3 : 8;
+}
+
+static uint32_t match_bits(uint32_t length, uint32_t distance) {
+    uint32_t extraBits;
+    uint32_t base;
+    uint32_t code = distance_code(distance, &extraBits, &base);
+    uint32_t lengthField = length - (code >= 9 ? 3 : 2);
+    return 1 + 2 + length_extra_bits(lengthField) + 4 + extraBits;
+}
+
+static uint32_t distance_code(uint32_t distance, uint32_t* extraBits, uint32_t* base) {
+    if (distance < 12) {
+        *extraBits = 2;
+        *base = distance & ~3u;
+        return distance >> 2;
+    }
+    uint32_t code = 3;
+    while (distance - 4 >= 2u << code) {
+        ++code;
+    }
+    *extraBits = code;
+    *base = (1u << code) + 4;
+    return code;
+}
+
+static void put_bits(bit_writer* bw, uint32_t value, uint32_t count) {
+    bw->bits |= (uint64_t)(value & (uint32_t)((1ULL << count) - 1)) << bw->count;
+    bw->count += count;
+    if (bw->count >= 32) {
+        if (bw->words < bw->capWords) {
+            store32le(bw->out + 4 * bw->words, (uint32_t)bw->bits);
+        }
+        ++bw->words;
+        bw->bits >>= 32;
+        bw->count -= 32;
+    }
+}
+
+static void put_literal(bit_writer* bw, uint8_t value) {
+    put_bits(bw, (uint32_t)value << 1, LITERAL_BITS);
+}
+
+static void put_match(bit_writer* bw, uint32_t length, uint32_t distance) {
+    static const uint32_t GROUP_BASE[4] = { 0, 2, 4, 12 };
+    static const uint32_t GROUP_BITS[4] = { 1, 1, 3, 8 };
+
+    uint32_t extraBits;
+    uint32_t base;
+    uint32_t code = distance_code(distance, &extraBits, &base);
+    uint32_t lengthField = length - (code >= 9 ? 3 : 2);
+    uint32_t group = lengthField < 2 ? 0 : lengthField < 4 ? 1 : lengthField < 12 ? 2 : 3;
+
+    put_bits(bw, 1 | group << 1, 3);
+    put_bits(bw, lengthField - GROUP_BASE[group], GROUP_BITS[group]);
+    put_bits(bw, code, 4);
+    put_bits(bw, distance - base, extraBits);
+}
@@ -0,0 +1,126 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*  Build-time generator for cprs_lut.h. Expands the length and distance
+    rows of CPRS_TABLE into the single-lookup token table described in
+    cprs_internal.h, adds the pattern tables used by copy_pattern(), and
+    prints it all as C. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CPRS_NO_LUT
+#include "cprs_internal.h"
+
+#define LENGTH_ROW(group) ((group) * 0x04)
+#define DISTANCE_ROW(code) ((code) * 0x04 + 0x10)
+
+static void check(int condition, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "cprs_gentable: %s\n", what);
+        exit(1);
+    }
+}
+
+/*  Distance code `code`, with the length bonus in place of the length. */
+static uint32_t distance_entry(uint32_t code, uint32_t consumed, uint32_t length) {
+    uint32_t row = DISTANCE_ROW(code);
+    uint32_t extra = CPRS_TABLE[row];
+    uint32_t base = CPRS_TABLE[row + 2];
+    uint32_t bonus = (CPRS_TABLE[row + 1] + 0xb) >> 3;
+
+    check(extra < 16, "distance extra bits don't fit");
+    check(base % 4 == 0 && base / 4 < (1U << 14), "distance base doesn't fit");
+    check(length + bonus < 0x100, "match length doesn't fit");
+
+    return lut_entry(consumed, 1, extra, length + bonus, base / 4);
+}
+
+static void print_table(const char* name, const uint32_t* table, size_t count) {
+    printf("static const uint32_t %s[%zu] = {", name, count);
+    for (size_t i = 0; i < count; ++i) {
+        printf("%s0x%08x%s", i % 8 ? " " : "\n    ", table[i], i + 1 < count ? "," : "\n");
+    }
+    printf("};\n");
+}
+
+static void print_rows(const uint8_t* table, size_t rows, size_t columns) {
+    for (size_t row = 0; row < rows; ++row) {
+        printf("\n    {");
+        for (size_t i = 0; i < columns; ++i) {
+            printf("%s%u", i ? ", " : " ", table[row * columns + i]);
+        }
+        printf(" }%s", row + 1 < rows ? "," : "\n");
+    }
+}
+
+int main(void) {
+    static uint32_t lut[1 << CPRS_LUT_BITS];
+    static uint32_t distanceLut[16];
+
+    check(CPRS_LUT_BITS >= 9, "index too narrow for literals");
+
+    for (uint32_t bits = 0; bits < (1U << CPRS_LUT_BITS); ++bits) {
+        if ((bits & 1) == 0) {
+            lut[bits] = lut_entry(9, 0, 0, bits >> 1 & 0xff, 0);
+            continue;
+        }
+
+        uint32_t row = LENGTH_ROW(bits >> 1 & 3);
+        uint32_t lengthBits = CPRS_TABLE[row];
+        uint32_t lengthBase = CPRS_TABLE[row + 2];
+        uint32_t consumed = 3 + lengthBits + 4;
+
+        if (consumed > CPRS_LUT_BITS) {
+            check(lengthBits < 16 && lengthBase < (1U << 14), "length group doesn't fit");
+            lut[bits] = lut_entry(3, 1, lengthBits, 0, lengthBase);
+            continue;
+        }
+
+        uint32_t length = lengthBase + (bits >> 3 & ((1U << lengthBits) - 1));
+        uint32_t code = bits >> (3 + lengthBits) & 0xf;
+        lut[bits] = distance_entry(code, consumed, length);
+    }
+
+    for (uint32_t code = 0; code < 16; ++code) {
+        distanceLut[code] = distance_entry(code, 4, 0);
+    }
+
+    static uint8_t shuffle[16][32];
+    static uint8_t stride[2][16];
+
+    for (uint32_t distance = 1; distance < 16; ++distance) {
+        for (uint32_t i = 0; i < 32; ++i) {
+            shuffle[distance][i] = i % distance;
+        }
+        stride[0][distance] = 16 - 16 % distance;
+        stride[1][distance] = 32 - 32 % distance;
+    }
+
+    printf("/*  Generated by cprs_gentable from CPRS_TABLE, do not edit. */\n\n");
+    print_table("CPRS_LUT", lut, 1 << CPRS_LUT_BITS);
+    printf("\n");
+    print_table("CPRS_DIST_LUT", distanceLut, 16);
+
+    printf("\nstatic const uint8_t CPRS_PATTERN_SHUFFLE[16][32] = {");
+    print_rows(&shuffle[0][0], 16, 32);
+    printf("};\n\nstatic const uint8_t CPRS_PATTERN_STRIDE[2][16] = {");
+    print_rows(&stride[0][0], 2, 16);
+    printf("};\n");
+    return 0;
+}
@@ -0,0 +1,332 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPRS_INTERNAL_H
+#define CPRS_INTERNAL_H
+
+/*  Shared between the libcprs translation units, not installed. */
+
+#include <stdint.h>
+#include <string.h>
+
+extern const uint32_t CPRS_TABLE[192];
+
+/*  Longest token: 1 flag bit, 2 length group bits, up to 8 length bits,
+    4 distance code bits and up to 15 distance bits. */
+#define CPRS_MAX_TOKEN_BITS 30
+
+static inline uint32_t load32le(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8
+        | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t load64le(const uint8_t* p) {
+    return (uint64_t)load32le(p) | (uint64_t)load32le(p + 4) << 32;
+}
+
+/*  Leading zero count of a non-zero value. */
+static inline uint32_t cprs_clz32(uint32_t v) {
+#if defined(__GNUC__)
+    return (uint32_t)__builtin_clz(v);
+#else
+    uint32_t count = 0;
+    while (!(v & 0x80000000u)) {
+        v <<= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+static inline void store32le(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/*  The alpha/beta pair of the original routine is just a little-endian,
+    LSB-first bitstream starting at word 3. This holds up to 63 bits of it
+    at once; `ptr` is the first byte that isn't (completely) in `bits`. */
+typedef struct cprs_bits {
+    const uint8_t* ptr;
+    const uint8_t* end;
+    uint64_t bits;
+    uint32_t count;
+    uint32_t padding;       /* zero bits added past `end` */
+} cprs_bits;
+
+static inline void bits_init(cprs_bits* br, const uint8_t* start, const uint8_t* end) {
+    br->ptr = start;
+    br->end = end;
+    br->bits = 0;
+    br->count = 0;
+    br->padding = 0;
+}
+
+/*  Tops the buffer up to at least 56 bits without branching. Needs 8
+    readable bytes at br->ptr. Bits above `count` may already hold the
+    next byte, but they always hold the right values so OR-ing them in
+    again is harmless. */
+static inline void bits_refill(cprs_bits* br) {
+    br->bits |= load64le(br->ptr) << br->count;
+    br->ptr += (63 - br->count) >> 3;
+    br->count |= 56;
+}
+
+/*  Byte-at-a-time refill for the last few bytes. Anything past the end
+    reads as zero; once more of those have been consumed than are still
+    buffered (padding > count) the stream has run off its end. */
+static inline void bits_refill_tail(cprs_bits* br) {
+    while (br->count <= 56) {
+        if (br->ptr < br->end) {
+            br->bits |= (uint64_t)*br->ptr++ << br->count;
+        } else {
+            br->padding += 8;
+        }
+        br->count += 8;
+    }
+}
+
+/*  Starts `br` `bitPos` bits into the stream at `start`, which must not be
+    past `end`. */
+static inline void bits_seek(cprs_bits* br, const uint8_t* start, const uint8_t* end, uint64_t bitPos) {
+    bits_init(br, start + (bitPos >> 3), end);
+    bits_refill_tail(br);
+    br->bits >>= bitPos & 7;
+    br->count -= bitPos & 7;
+}
+
+/*  Bits consumed since `start`; bits_seek() with this picks up again at
+    the same token. */
+static inline uint64_t bits_position(const cprs_bits* br, const uint8_t* start) {
+    return (uint64_t)(br->ptr - start) * 8 + br->padding - br->count;
+}
+
+static inline uint32_t bits_peek(const cprs_bits* br, uint32_t count) {
+    return br->bits & ((1ULL << count) - 1);
+}
+
+static inline void bits_consume(cprs_bits* br, uint32_t count) {
+    br->bits >>= count;
+    br->count -= count;
+}
+
+/*  Most output a single token produces. */
+#define CPRS_MAX_TOKEN_OUTPUT 270
+
+/*  Start and stop points of a partial decode (CORE_RANGE), where the
+    checkpoints of an indexed one go (CORE_INDEX), and the token records of
+    a traced one (CORE_TRACE). */
+typedef struct cprs_span {
+    uint64_t bitPos;        /* payload bits before the first token */
+    size_t outPos;          /* bytes already in `out` ahead of the first token */
+    size_t stop;            /* stop at the first token boundary at or after this */
+    uint64_t stopBit;       /* CORE_SPLIT: or at the first one at or past this bit */
+
+    size_t interval;
+    uint8_t* entries;       /* CPRS_INDEX_ENTRY_SIZE bytes per checkpoint */
+    uint32_t count;
+    uint32_t capacity;
+
+    uint8_t* records;       /* CORE_TRACE: a batch of token records */
+    uint32_t recordCount;
+    int (*sink)(void* context, const void* records, size_t count);
+    void* context;
+} cprs_span;
+
+/*  Checkpoint layout in an index: payload bit position (64 bits), output
+    offset and window length (32 bits each), all little-endian. */
+#define CPRS_INDEX_ENTRY_SIZE 16
+#define CPRS_INDEX_HEADER_SIZE 20
+
+/*  Single-lookup token table, generated from CPRS_TABLE by cprs_gentable
+    and indexed by the next CPRS_LUT_BITS bits of the stream. Each entry
+    packs everything needed to decode a token short enough to be resolved
+    from those bits:
+
+        bits  0..4   bits consumed (up to the distance extra bits)
+        bit   5      match flag
+        bits  6..9   number of distance extra bits
+        bits 10..17  literal byte, or full match length
+        bits 18..31  distance base / 4
+
+    A match length of 0 marks a length group whose extra bits don't fit in
+    the index. Those entries only consume the 3 selector bits, keep the
+    group's extra bit count in bits 6..9 and its base in bits 18..31, and
+    the decoder finishes them through CPRS_DIST_LUT, which is laid out the
+    same way for the 4-bit distance code on its own (with the length field
+    holding the distance-dependent length bonus). */
+#define CPRS_LUT_BITS 10
+#define CPRS_LUT_MASK ((1U << CPRS_LUT_BITS) - 1)
+
+#define CPRS_LUT_MATCH 0x20
+
+#define lut_entry(consumed, match, extra, value, high)                         \
+    ((consumed) | ((match) ? CPRS_LUT_MATCH : 0) | (extra) << 6                \
+     | (value) << 10 | (uint32_t)(high) << 18)
+
+#define lut_consumed(entry)   ((entry) & 0x1f)
+#define lut_extra(entry)      ((entry) >> 6 & 0xf)
+#define lut_value(entry)      ((entry) >> 10 & 0xff)
+#define lut_high(entry)       ((entry) >> 18)
+
+#ifndef CPRS_NO_LUT
+
+#include "cprs_lut.h"
+
+/*  Finishes decoding the match token at the bottom of `bits`, given its
+    CPRS_LUT entry. Returns the token's size in bits. */
+static inline uint32_t decode_match(uint64_t bits, uint32_t entry, uint32_t* length, uint32_t* distance) {
+    uint32_t consumed = lut_consumed(entry);
+    uint32_t matchLength = lut_value(entry);
+
+    if (matchLength == 0) {
+        uint32_t lengthBits = lut_extra(entry);
+        matchLength = lut_high(entry) + (bits >> consumed & ((1U << lengthBits) - 1));
+        consumed += lengthBits;
+        entry = CPRS_DIST_LUT[bits >> consumed & 0xf];
+        matchLength += lut_value(entry);
+        consumed += lut_consumed(entry);
+    }
+
+    uint32_t distanceBits = lut_extra(entry);
+    *distance = lut_high(entry) * 4 + (bits >> consumed & ((1U << distanceBits) - 1));
+    *length = matchLength;
+
+    return consumed + distanceBits;
+}
+
+/*  Wide copies may store up to this many bytes past the end of a match. */
+#if defined(__AVX2__)
+#define COPY_SLACK 32
+#else
+#define COPY_SLACK 16
+#endif
+
+/*  Matches closer than 16 bytes overlap their own output. Their first
+    `distance` bytes repeat over and over, so the pattern is expanded into
+    a whole vector once (CPRS_PATTERN_SHUFFLE[distance][i] is i % distance)
+    and then stored in steps of the largest multiple of the distance that
+    fits in the vector, which keeps every store in phase. */
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+static inline uint8_t* copy_pattern(uint8_t* op, uint8_t* end, const uint8_t* src, uint32_t distance) {
+    __m256i source = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)src));
+    __m256i shuffle = _mm256_loadu_si256((const __m256i*)CPRS_PATTERN_SHUFFLE[distance]);
+    __m256i pattern = _mm256_shuffle_epi8(source, shuffle);
+    uint32_t stride = CPRS_PATTERN_STRIDE[1][distance];
+    do {
+        _mm256_storeu_si256((__m256i*)op, pattern);
+        op += stride;
+    } while (op < end);
+    return end;
+}
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+
+static inline uint8_t* copy_pattern(uint8_t* op, uint8_t* end, const uint8_t* src, uint32_t distance) {
+    __m128i source = _mm_loadu_si128((const __m128i*)src);
+    __m128i shuffle = _mm_loadu_si128((const __m128i*)CPRS_PATTERN_SHUFFLE[distance]);
+    __m128i pattern = _mm_shuffle_epi8(source, shuffle);
+    uint32_t stride = CPRS_PATTERN_STRIDE[0][distance];
+    do {
+        _mm_storeu_si128((__m128i*)op, pattern);
+        op += stride;
+    } while (op < end);
+    return end;
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+
+static inline uint8_t* copy_pattern(uint8_t* op, uint8_t* end, const uint8_t* src, uint32_t distance) {
+    uint8x16_t pattern = vqtbl1q_u8(vld1q_u8(src), vld1q_u8(CPRS_PATTERN_SHUFFLE[distance]));
+    uint32_t stride = CPRS_PATTERN_STRIDE[0][distance];
+    do {
+        vst1q_u8(op, pattern);
+        op += stride;
+    } while (op < end);
+    return end;
+}
+#else
+/*  Without a byte shuffle the pattern is gathered through the same table
+    into a 16-byte buffer, which still gets stored whole (as one SSE2 store
+    where the compiler has them). */
+static inline uint8_t* copy_pattern(uint8_t* op, uint8_t* end, const uint8_t* src, uint32_t distance) {
+    uint8_t pattern[16];
+    for (uint32_t i = 0; i < 16; ++i) {
+        pattern[i] = src[CPRS_PATTERN_SHUFFLE[distance][i]];
+    }
+    uint32_t stride = CPRS_PATTERN_STRIDE[0][distance];
+    do {
+        memcpy(op, pattern, 16);
+        op += stride;
+    } while (op < end);
+    return end;
+}
+#endif
+
+/*  Copies a back-reference of `length` bytes from `distance` bytes behind
+    `op`. From 16 bytes on, every chunk's source bytes are already final by
+    the time they are loaded, so overlap doesn't matter and a plain wide
+    copy gives the same result as the byte loop. */
+static inline uint8_t* copy_match(uint8_t* op, uint32_t length, uint32_t distance, const uint8_t* outEnd) {
+    const uint8_t* src = op - distance;
+    uint8_t* end = op + length;
+
+    if ((size_t)(outEnd - op) >= length + COPY_SLACK) {
+        if (distance < 16) {
+            return copy_pattern(op, end, src, distance);
+        }
+        do {
+            memcpy(op, src, 16);
+            op += 16;
+            src += 16;
+        } while (op < end);
+        return end;
+    }
+
+    while (op < end) {
+        *op++ = *src++;
+    }
+    return end;
+}
+
+/*  Writes a distance 0 match, which repeats the last output byte. Runs of
+    zeroes and 0xff are common enough in firmware images to be worth
+    storing 16 bytes at a time. */
+static inline uint8_t* fill_run(uint8_t* op, uint32_t length, uint8_t value, const uint8_t* outEnd) {
+    uint8_t* end = op + length;
+
+    if ((size_t)(outEnd - op) >= length + COPY_SLACK) {
+        uint64_t pattern = value * 0x0101010101010101ULL;
+        do {
+            memcpy(op, &pattern, 8);
+            memcpy(op + 8, &pattern, 8);
+            op += 16;
+        } while (op < end);
+        return end;
+    }
+
+    memset(op, value, length);
+    return end;
+}
+
+#endif /* CPRS_NO_LUT */
+
+#endif
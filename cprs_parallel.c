@@ -0,0 +1,464 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "cprs_internal.h"
+
+#define CORE_NAME decode_split
+#define CORE_STATS 0
+#define CORE_RANGE 1
+#define CORE_SPLIT 1
+#include "cprs_decode_core.h"
+
+/*  Speculative parallel decoding, after pugz. The only state carried from
+    one token to the next is the bit position (the byte a run repeats is
+    the last one written), so a stretch of the stream can be decoded from
+    any token boundary, as long as whatever it copies from before that
+    point is left to be filled in later.
+
+    Finding a boundary: the first one at or after a guessed bit position is
+    less than CPRS_MAX_TOKEN_BITS further on, so of the parses started at
+    each of those offsets one is the real parse. Parses of a prefix code
+    that hit the same position carry on identically, and once all of them
+    have met, that position is on the real parse too. A stretch where they
+    don't meet within SYNC_LIMIT bits is merged into the one before it.
+
+    Decoding a stretch: until the last CPRS_WINDOW_SIZE bytes of its output
+    hold no placeholders, it runs on symbols, where values from HOLE on
+    stand for byte (symbol - HOLE) of the window before the stretch.
+    Nothing can refer further back than that, so from then on it runs the
+    plain decode loop on bytes, stopping at the first token boundary at or
+    past the next stretch's start. The placeholders left in the symbol part
+    are kept as a list.
+
+    Finishing: the stretches only line up if each one ended exactly where
+    the next began; region 0 starts at the real start, so that makes every
+    other start real as well. They are then copied into place in order,
+    which is also what makes the bytes every placeholder names final by the
+    time it is filled in. */
+
+#define SYNC_LIMIT      0x10000
+#define SYMBOLS_INITIAL 0x10000
+#define HOLE            ((uint32_t)0x100)
+
+typedef struct hole {
+    size_t pos;
+    uint32_t source;        /* offset into the window before the region */
+} hole;
+
+typedef struct region {
+    uint64_t start;         /* bit position of the first token */
+    uint64_t stop;          /* the region ends at the first boundary at or past this */
+    uint64_t end;           /* where it did */
+    int ended;              /* reached the terminator instead */
+    int status;
+
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+
+    hole* holes;
+    size_t holeCount;
+} region;
+
+struct cprs_parallel {
+    const uint8_t* in;
+    size_t inLen;
+    uint8_t* out;
+    size_t outCap;
+    cprs_header header;
+
+    region* regions;
+    size_t count;
+};
+
+/*  Size of the token at `pos`, or 0 if it runs off the end or is the
+    terminator. */
+static uint32_t token_bits(const uint8_t* start, const uint8_t* end, uint64_t pos) {
+    if (pos / 8 >= (uint64_t)(end - start)) {
+        return 0;
+    }
+
+    cprs_bits br;
+    bits_seek(&br, start, end, pos);
+    uint32_t entry = CPRS_LUT[br.bits & CPRS_LUT_MASK];
+    uint32_t consumed = 9;
+    if (entry & CPRS_LUT_MATCH) {
+        uint32_t length;
+        uint32_t distance;
+        consumed = decode_match(br.bits, entry, &length, &distance);
+        if (distance >= CPRS_TERM) {
+            return 0;
+        }
+    }
+
+    bits_consume(&br, consumed);
+    return br.padding > br.count ? 0 : consumed;
+}
+
+/*  Runs the parses from every offset in [guess, guess + CPRS_MAX_TOKEN_BITS)
+    forward, always advancing the one furthest behind, until they meet. */
+static int sync_region(const uint8_t* start, const uint8_t* end, uint64_t guess, uint64_t* boundary) {
+    uint64_t pos[CPRS_MAX_TOKEN_BITS];
+    for (uint32_t i = 0; i < CPRS_MAX_TOKEN_BITS; ++i) {
+        pos[i] = guess + i;
+    }
+
+    while (1) {
+        uint64_t low = pos[0];
+        uint64_t high = pos[0];
+        for (uint32_t i = 1; i < CPRS_MAX_TOKEN_BITS; ++i) {
+            low = pos[i] < low ? pos[i] : low;
+            high = pos[i] > high ? pos[i] : high;
+        }
+        if (low == high) {
+            *boundary = low;
+            return 1;
+        }
+        if (low - guess > SYNC_LIMIT) {
+            return 0;
+        }
+
+        uint32_t size = token_bits(start, end, low);
+        if (size == 0) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < CPRS_MAX_TOKEN_BITS; ++i) {
+            if (pos[i] == low) {
+                pos[i] = low + size;
+            }
+        }
+    }
+}
+
+/*  Grows the region's byte buffer to at least `needed`, starting from a
+    guess at its whole output from the header's ratio. Nothing beyond an
+    outCap's worth of output (and the largest token) is ever allocated. */
+static int region_reserve(cprs_parallel* job, region* r, size_t needed) {
+    size_t limit = job->outCap + 1 + CPRS_MAX_TOKEN_OUTPUT;
+    size_t capacity = r->capacity * 2;
+    if (!r->bytes) {
+        uint64_t stop = r->stop < (uint64_t)(job->inLen - 12) * 8 ? r->stop : (uint64_t)(job->inLen - 12) * 8;
+        double ratio = (double)job->header.decompressedSize / (job->header.compressedSize | 1);
+        double guess = (double)(stop - r->start) / 8 * ratio * 1.25;
+        capacity = guess < (double)limit ? (size_t)guess : limit;
+    }
+    capacity = capacity > needed ? capacity : needed;
+    capacity = capacity < limit ? capacity : limit;
+    if (capacity < needed) {
+        return CPRS_E_CORRUPT;
+    }
+
+    uint8_t* bytes = realloc(r->bytes, capacity);
+    if (!bytes) {
+        return CPRS_E_NOMEM;
+    }
+    r->bytes = bytes;
+    r->capacity = capacity;
+    return CPRS_OK;
+}
+
+/*  The symbol phase of a region after the first. Returns with *done set
+    if the region ended in it, else with *bitPos where the byte phase picks
+    up. Either way the output so far is in r->bytes and r->holes. */
+static int decode_symbols(cprs_parallel* job, region* r, uint64_t* bitPos, int* done) {
+    const uint8_t* start = job->in + 12;
+    const uint8_t* end = job->in + job->inLen;
+
+    uint32_t* symbols = 0;
+    size_t capacity = 0;
+    size_t n = 0;
+    size_t clean = 0;       /* first position after the last placeholder */
+    uint32_t carry = HOLE + CPRS_WINDOW_SIZE - 1;
+    int status = CPRS_OK;
+
+    cprs_bits br;
+    bits_seek(&br, start, end, r->start);
+    *done = 1;
+
+    while (1) {
+        uint64_t pos = bits_position(&br, start);
+        if (pos >= r->stop) {
+            r->end = pos;
+            break;
+        }
+        if (n - clean >= CPRS_WINDOW_SIZE) {
+            *bitPos = pos;
+            *done = 0;
+            break;
+        }
+
+        if (br.count < CPRS_MAX_TOKEN_BITS) {
+            if (br.end - br.ptr >= 8) {
+                bits_refill(&br);
+            } else {
+                bits_refill_tail(&br);
+            }
+        }
+
+        uint32_t entry = CPRS_LUT[br.bits & CPRS_LUT_MASK];
+        uint32_t length = 1;
+        uint32_t distance = 0;
+        int literal = !(entry & CPRS_LUT_MATCH);
+        bits_consume(&br, literal ? 9 : decode_match(br.bits, entry, &length, &distance));
+
+        if (br.padding > br.count) {
+            status = CPRS_E_TRUNC;
+            break;
+        }
+        if (distance >= CPRS_TERM) {
+            r->ended = 1;
+            break;
+        }
+        if (length > job->outCap - n) {
+            status = CPRS_E_CORRUPT;
+            break;
+        }
+
+        if (n + length > capacity) {
+            size_t grown = capacity ? capacity * 2 : SYMBOLS_INITIAL;
+            grown = grown > n + length ? grown : n + length;
+            uint32_t* larger = realloc(symbols, grown * sizeof(uint32_t));
+            if (!larger) {
+                status = CPRS_E_NOMEM;
+                break;
+            }
+            symbols = larger;
+            capacity = grown;
+        }
+
+        if (literal) {
+            carry = lut_value(entry);
+            symbols[n++] = carry;
+        } else if (distance == 0) {
+            for (uint32_t i = 0; i < length; ++i) {
+                symbols[n++] = carry;
+            }
+            clean = carry >= HOLE ? n : clean;
+        } else if (n >= clean + (size_t)distance * 2) {
+            /*  Nothing from the last placeholder on, so none get copied. */
+            const uint32_t* src = symbols + n - (size_t)distance * 2;
+            for (uint32_t i = 0; i < length; ++i, ++n) {
+                symbols[n] = *src++;
+            }
+            carry = symbols[n - 1];
+        } else {
+            size_t back = (size_t)distance * 2;
+            for (uint32_t i = 0; i < length; ++i, ++n) {
+                uint32_t value = n >= back ? symbols[n - back] : HOLE + (uint32_t)(CPRS_WINDOW_SIZE - (back - n));
+                symbols[n] = value;
+                clean = value >= HOLE ? n + 1 : clean;
+            }
+            carry = symbols[n - 1];
+        }
+    }
+
+    if (status == CPRS_OK) {
+        status = region_reserve(job, r, *done ? n : n + 1 + CPRS_MAX_TOKEN_OUTPUT);
+    }
+    size_t holeCount = 0;
+    for (size_t i = 0; status == CPRS_OK && i < clean; ++i) {
+        holeCount += symbols[i] >= HOLE;
+    }
+    if (status == CPRS_OK && holeCount && !(r->holes = malloc(holeCount * sizeof(hole)))) {
+        status = CPRS_E_NOMEM;
+    }
+
+    if (status == CPRS_OK) {
+        for (size_t i = 0; i < n; ++i) {
+            if (symbols[i] >= HOLE) {
+                r->holes[r->holeCount].pos = i;
+                r->holes[r->holeCount++].source = symbols[i] - HOLE;
+                r->bytes[i] = 0;
+            } else {
+                r->bytes[i] = (uint8_t)symbols[i];
+            }
+        }
+        r->length = n;
+    }
+    free(symbols);
+    return status;
+}
+
+/*  The byte phase, growing the buffer whenever the decode stops short of
+    both the next region and the terminator. */
+static int decode_bytes(cprs_parallel* job, region* r, uint64_t bitPos) {
+    while (1) {
+        cprs_span span;
+        memset(&span, 0, sizeof(span));
+        span.bitPos = bitPos;
+        span.outPos = r->length;
+        span.stop = r->capacity - CPRS_MAX_TOKEN_OUTPUT;
+        span.stopBit = r->stop;
+
+        size_t decoded;
+        int status = decode_split(job->in, job->inLen, r->bytes, r->capacity, &decoded, 0, &span);
+        if (status != CPRS_OK) {
+            return status;
+        }
+        r->length = decoded;
+
+        if (span.bitPos >= r->stop) {
+            r->end = span.bitPos;
+            return CPRS_OK;
+        }
+        /*  Short of the stop means the terminator came first. */
+        if (decoded < span.stop) {
+            r->ended = 1;
+            return CPRS_OK;
+        }
+
+        bitPos = span.bitPos;
+        status = region_reserve(job, r, r->capacity + 1);
+        if (status != CPRS_OK) {
+            return status;
+        }
+    }
+}
+
+int cprs_parallel_begin(const void* in, size_t inLen, void* out, size_t outCap, size_t regions,
+                        cprs_parallel** job) {
+    cprs_header header;
+    int status = cprs_header_peek(in, inLen, &header);
+    if (status != CPRS_OK) {
+        return status;
+    }
+
+    if (outCap < header.decompressedSize) {
+        return CPRS_E_SPACE;
+    }
+
+    /*  Only the first member's bitstream is one stream. */
+    size_t payload = (header.compressedSize < inLen ? header.compressedSize : inLen) - 12;
+    if (regions > payload / CPRS_PARALLEL_MIN_REGION) {
+        regions = payload / CPRS_PARALLEL_MIN_REGION;
+    }
+    if (regions == 0) {
+        regions = 1;
+    }
+
+    cprs_parallel* p = calloc(1, sizeof(cprs_parallel));
+    region* r = calloc(regions, sizeof(region));
+    if (!p || !r) {
+        free(p);
+        free(r);
+        return CPRS_E_NOMEM;
+    }
+    p->in = in;
+    p->inLen = inLen;
+    p->out = out;
+    p->outCap = outCap;
+    p->header = header;
+    p->regions = r;
+    p->count = 1;
+
+    const uint8_t* start = p->in + 12;
+    for (size_t i = 1; i < regions; ++i) {
+        uint64_t boundary;
+        uint64_t guess = (uint64_t)payload * 8 / regions * i;
+        if (sync_region(start, p->in + inLen, guess, &boundary) && boundary > r[p->count - 1].start) {
+            r[p->count++].start = boundary;
+        }
+    }
+    for (size_t i = 0; i < p->count; ++i) {
+        r[i].stop = i + 1 < p->count ? r[i + 1].start : UINT64_MAX;
+    }
+
+    *job = p;
+    return CPRS_OK;
+}
+
+size_t cprs_parallel_regions(const cprs_parallel* job) {
+    return job->count;
+}
+
+void cprs_parallel_decode(cprs_parallel* job, size_t index) {
+    /*  With a single region the serial decode in cprs_parallel_finish()
+        does it all. */
+    if (job->count < 2) {
+        return;
+    }
+
+    region* r = &job->regions[index];
+    uint64_t bitPos = r->start;
+    if (index > 0) {
+        int done;
+        r->status = decode_symbols(job, r, &bitPos, &done);
+        if (r->status != CPRS_OK || done) {
+            return;
+        }
+    } else {
+        r->status = region_reserve(job, r, 1 + CPRS_MAX_TOKEN_OUTPUT);
+        if (r->status != CPRS_OK) {
+            return;
+        }
+    }
+    r->status = decode_bytes(job, r, bitPos);
+}
+
+int cprs_parallel_finish(cprs_parallel* job, size_t* outLen, size_t* regionsUsed) {
+    int serial = job->count < 2;
+    size_t total = 0;
+    for (size_t i = 0; i < job->count && !serial; ++i) {
+        region* r = &job->regions[i];
+        int last = i + 1 == job->count;
+        serial = r->status != CPRS_OK || r->ended != last || (!last && r->end != r[1].start);
+        total += r->length;
+    }
+    serial = serial || total > job->outCap;
+
+    size_t offset = 0;
+    for (size_t i = 0; i < job->count && !serial; ++i) {
+        region* r = &job->regions[i];
+        memcpy(job->out + offset, r->bytes, r->length);
+        for (size_t h = 0; h < r->holeCount && !serial; ++h) {
+            const hole* x = &r->holes[h];
+            if (offset + x->source < CPRS_WINDOW_SIZE) {
+                serial = 1;
+            } else {
+                job->out[offset + x->pos] = job->out[offset + x->source - CPRS_WINDOW_SIZE];
+            }
+        }
+        offset += r->length;
+    }
+
+    int status = CPRS_OK;
+    size_t used = job->count;
+    if (serial) {
+        status = cprs_decode(job->in, job->inLen, job->out, job->outCap, &total);
+        used = 0;
+    }
+
+    for (size_t i = 0; i < job->count; ++i) {
+        free(job->regions[i].bytes);
+        free(job->regions[i].holes);
+    }
+    free(job->regions);
+    free(job);
+
+    if (outLen) {
+        *outLen = total;
+    }
+    if (regionsUsed) {
+        *regionsUsed = used;
+    }
+    return status;
+}
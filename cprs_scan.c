@@ -0,0 +1,120 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "cprs_internal.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/*  Bytes looked at per step of the vector search. */
+#define SCAN_BLOCK 64
+
+static size_t find_sig(const uint8_t* data, size_t offset, size_t end);
+static int block_has_sig(const uint8_t* p);
+
+int cprs_scan(const void* in, size_t inLen, size_t offset, size_t* memberOffset, cprs_header* header) {
+    const uint8_t* data = in;
+
+    offset = (offset + 3) & ~(size_t)3;
+    while (offset + CPRS_HEADER_SIZE < inLen) {
+        offset = find_sig(data, offset, inLen);
+        if (offset + CPRS_HEADER_SIZE >= inLen) {
+            break;
+        }
+
+        /*  compressedSize covers the whole member, both signatures
+            included, so it tells us where the trailing one must be. */
+        uint32_t size = load32le(data + offset + 4);
+        if (size % 4 == 0 && size > CPRS_HEADER_SIZE && size <= inLen - offset
+                && load32le(data + offset + size - 4) == CPRS_SIG) {
+            *memberOffset = offset;
+            if (header) {
+                header->compressedSize = size;
+                header->decompressedSize = load32le(data + offset + 8);
+            }
+            return CPRS_OK;
+        }
+        offset += 4;
+    }
+    return CPRS_E_SIG;
+}
+
+/*  Offset of the first CPRS_SIG word at a multiple of 4 in [offset, end),
+    or `end` if there isn't one. `offset` must be a multiple of 4. */
+static size_t find_sig(const uint8_t* data, size_t offset, size_t end) {
+    while (offset % SCAN_BLOCK != 0 && offset + 4 <= end) {
+        if (load32le(data + offset) == CPRS_SIG) {
+            return offset;
+        }
+        offset += 4;
+    }
+
+    while (offset + SCAN_BLOCK <= end && !block_has_sig(data + offset)) {
+        offset += SCAN_BLOCK;
+    }
+
+    for (; offset + 4 <= end; offset += 4) {
+        if (load32le(data + offset) == CPRS_SIG) {
+            return offset;
+        }
+    }
+    return end;
+}
+
+/*  Whether any of the 16 words at `p` is CPRS_SIG. Only answers yes or
+    no; the word-wise loop after it finds which one. */
+static int block_has_sig(const uint8_t* p) {
+#if defined(__AVX2__)
+    const __m256i sig = _mm256_set1_epi32((int)CPRS_SIG);
+    __m256i a = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)p), sig);
+    __m256i b = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(p + 32)), sig);
+    return !_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b));
+#elif defined(__SSE2__)
+    const __m128i sig = _mm_set1_epi32((int)CPRS_SIG);
+    __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)p), sig);
+    __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(p + 16)), sig);
+    __m128i c = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(p + 32)), sig);
+    __m128i d = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(p + 48)), sig);
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) != 0;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint32x4_t sig = vdupq_n_u32(CPRS_SIG);
+    uint32x4_t a = vceqq_u32(vreinterpretq_u32_u8(vld1q_u8(p)), sig);
+    uint32x4_t b = vceqq_u32(vreinterpretq_u32_u8(vld1q_u8(p + 16)), sig);
+    uint32x4_t c = vceqq_u32(vreinterpretq_u32_u8(vld1q_u8(p + 32)), sig);
+    uint32x4_t d = vceqq_u32(vreinterpretq_u32_u8(vld1q_u8(p + 48)), sig);
+    return vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d))) != 0;
+#else
+    /*  Two words per load; the compare results are OR'd rather than
+        branched on so the compiler is free to unroll this. */
+    const uint64_t sig = (uint64_t)CPRS_SIG << 32 | CPRS_SIG;
+    int hit = 0;
+    for (int i = 0; i < SCAN_BLOCK; i += 8) {
+        uint64_t x = load64le(p + i) ^ sig;
+        hit |= ((uint32_t)x == 0) | ((x >> 32) == 0);
+    }
+    return hit != 0;
+#endif
+}
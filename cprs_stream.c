@@ -0,0 +1,223 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "cprs_internal.h"
+
+#define PHASE_HEADER    0
+#define PHASE_TOKENS    1
+#define PHASE_DONE      2
+
+/*  Same bit buffer as cprs_decode(), filled a byte at a time from whatever
+    input is at hand. A token is only started once CPRS_MAX_TOKEN_BITS are
+    buffered, so the decoder can stop between any two tokens (or in the
+    middle of a match) and pick up again on the next push. */
+struct cprs_stream {
+    int phase;
+    int status;
+
+    uint8_t staged[CPRS_HEADER_SIZE];
+    uint32_t stagedBytes;
+
+    cprs_header header;
+
+    uint64_t bits;
+    uint32_t count;
+
+    uint8_t writeCarryByte;
+    uint32_t matchLength;
+    uint32_t matchDistance;
+
+    uint32_t extractedBytes;
+
+    /*  Ring of the last CPRS_WINDOW_SIZE output bytes. The newest `pending`
+        of them have not been pulled yet. */
+    uint32_t head;
+    uint32_t pending;
+    uint8_t window[CPRS_WINDOW_SIZE];
+};
+
+static int stage(cprs_stream* stream, const uint8_t** in, const uint8_t* end, uint32_t wanted);
+static int run(cprs_stream* stream, const uint8_t** in, const uint8_t* end);
+
+cprs_stream* cprs_stream_create(void) {
+    cprs_stream* stream = calloc(1, sizeof(cprs_stream));
+    if (stream) {
+        cprs_stream_reset(stream);
+    }
+    return stream;
+}
+
+void cprs_stream_destroy(cprs_stream* stream) {
+    free(stream);
+}
+
+void cprs_stream_reset(cprs_stream* stream) {
+    stream->phase = PHASE_HEADER;
+    stream->status = CPRS_OK;
+    stream->stagedBytes = 0;
+    stream->bits = 0;
+    stream->count = 0;
+    stream->writeCarryByte = 0;
+    stream->matchLength = 0;
+    stream->extractedBytes = 0;
+    stream->head = 0;
+    stream->pending = 0;
+}
+
+int cprs_stream_header(const cprs_stream* stream, cprs_header* header) {
+    if (stream->phase == PHASE_HEADER) {
+        return CPRS_E_TRUNC;
+    }
+    if (header) {
+        *header = stream->header;
+    }
+    return CPRS_OK;
+}
+
+int cprs_stream_push(cprs_stream* stream, const void* in, size_t inLen, size_t* inUsed) {
+    const uint8_t* cursor = in;
+    int status = run(stream, &cursor, cursor + inLen);
+    if (inUsed) {
+        *inUsed = cursor - (const uint8_t*)in;
+    }
+    return status;
+}
+
+size_t cprs_stream_pull(cprs_stream* stream, void* out, size_t outCap) {
+    size_t count = stream->pending < outCap ? stream->pending : outCap;
+    uint32_t start = stream->head >= stream->pending
+        ? stream->head - stream->pending
+        : stream->head + CPRS_WINDOW_SIZE - stream->pending;
+
+    size_t first = CPRS_WINDOW_SIZE - start;
+    if (first > count) {
+        first = count;
+    }
+    memcpy(out, stream->window + start, first);
+    memcpy((uint8_t*)out + first, stream->window, count - first);
+
+    stream->pending -= count;
+    return count;
+}
+
+/*  Gathers input into stream->staged until `wanted` bytes are there. */
+static int stage(cprs_stream* stream, const uint8_t** in, const uint8_t* end, uint32_t wanted) {
+    size_t available = end - *in;
+    size_t needed = wanted - stream->stagedBytes;
+    size_t count = available < needed ? available : needed;
+
+    memcpy(stream->staged + stream->stagedBytes, *in, count);
+    stream->stagedBytes += count;
+    *in += count;
+
+    if (stream->stagedBytes < wanted) {
+        return 0;
+    }
+    stream->stagedBytes = 0;
+    return 1;
+}
+
+static inline void emit(cprs_stream* stream, uint8_t value) {
+    stream->window[stream->head] = value;
+    if (++stream->head == CPRS_WINDOW_SIZE) {
+        stream->head = 0;
+    }
+    stream->pending += 1;
+    stream->extractedBytes += 1;
+}
+
+static int run(cprs_stream* stream, const uint8_t** in, const uint8_t* end) {
+    if (stream->status != CPRS_OK) {
+        return stream->status;
+    }
+
+    if (stream->phase == PHASE_HEADER) {
+        if (!stage(stream, in, end, CPRS_HEADER_SIZE)) {
+            return CPRS_OK;
+        }
+        if (load32le(stream->staged) != CPRS_SIG) {
+            return stream->status = CPRS_E_SIG;
+        }
+        stream->header.compressedSize = load32le(stream->staged + 4);
+        stream->header.decompressedSize = load32le(stream->staged + 8);
+        stream->bits = load64le(stream->staged + 12);
+        stream->count = 64;
+        stream->phase = PHASE_TOKENS;
+    }
+
+    while (1) {
+        while (stream->matchLength) {
+            if (stream->pending == CPRS_WINDOW_SIZE) {
+                return CPRS_STREAM_FULL;
+            }
+            if (stream->matchDistance) {
+                uint32_t source = stream->head >= stream->matchDistance
+                    ? stream->head - stream->matchDistance
+                    : stream->head + CPRS_WINDOW_SIZE - stream->matchDistance;
+                stream->writeCarryByte = stream->window[source];
+            }
+            emit(stream, stream->writeCarryByte);
+            stream->matchLength -= 1;
+        }
+
+        if (stream->count < CPRS_MAX_TOKEN_BITS) {
+            while (stream->count <= 56 && *in < end) {
+                stream->bits |= (uint64_t)*(*in)++ << stream->count;
+                stream->count += 8;
+            }
+            if (stream->count < CPRS_MAX_TOKEN_BITS) {
+                return CPRS_OK;
+            }
+        }
+
+        if (stream->pending == CPRS_WINDOW_SIZE) {
+            return CPRS_STREAM_FULL;
+        }
+
+        uint64_t bits = stream->bits;
+        uint32_t entry = CPRS_LUT[bits & CPRS_LUT_MASK];
+
+        if (!(entry & CPRS_LUT_MATCH)) {
+            stream->writeCarryByte = lut_value(entry);
+            stream->bits >>= 9;
+            stream->count -= 9;
+            emit(stream, stream->writeCarryByte);
+            continue;
+        }
+
+        uint32_t length;
+        uint32_t distance;
+        uint32_t consumed = decode_match(bits, entry, &length, &distance);
+        stream->bits >>= consumed;
+        stream->count -= consumed;
+
+        if (distance >= CPRS_TERM) {
+            stream->phase = PHASE_DONE;
+            return stream->status = CPRS_STREAM_END;
+        }
+        if (distance * 2 > stream->extractedBytes) {
+            return stream->status = CPRS_E_CORRUPT;
+        }
+        stream->matchLength = length;
+        stream->matchDistance = distance * 2;
+    }
+}
@@ -0,0 +1,665 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION 31
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fuse.h>
+
+#include "cprs.h"
+#include "uncprs.h"
+
+/*  Read-only FUSE view of a directory of images: subdirectories are shown
+    as they are and every `NAME.cprs` as a file `NAME` holding its decoded
+    output, with the header's decompressedSize as its size. An image made
+    of several members back to back, as `mkcprs --jobs` writes, shows as
+    their outputs one after another, each member with its own index and
+    chunks. Nothing is decoded up front. Reads are served in CHUNK_SIZE pieces through
+    cprs_decode_range() from the image's checkpoint index, which is the
+    `NAME.cprs.idx` sidecar that `uncprs --index` writes when there is one
+    and is otherwise built by cprs_index_build() the first time a read
+    needs it.
+
+    Decoded chunks go in a single LRU cache shared by all images and kept
+    under --cache-size, so memory doesn't grow with the number of images
+    mounted: an image only costs its mapping and index while it is open.
+    Chunks are keyed by the image file's identity (device, inode, size and
+    mtime) and their member and number within it, so they survive the
+    image being closed and opened again. A member's built index goes in
+    the same cache as its chunk INDEX_CHUNK, so reopening
+    an image without a sidecar doesn't mean another pass over it; each
+    open image works from its own copy, which eviction can't pull out from
+    under a read. */
+
+#define CPRS_SUFFIX         ".cprs"
+#define INDEX_SUFFIX        ".idx"
+#define CHUNK_SIZE          CPRS_INDEX_INTERVAL
+#define CHUNK_BUCKETS       4096
+#define CHUNK_CACHE_LIMIT   ((uint64_t)256 << 20)
+#define MEMBER_SHIFT        40
+#define INDEX_CHUNK         (((uint64_t)1 << MEMBER_SHIFT) - 1)
+
+typedef struct chunk {
+    uint64_t image;
+    uint64_t number;
+    uint8_t* data;
+    size_t size;
+    struct chunk* next;         /* in the bucket */
+    struct chunk* newer;
+    struct chunk* older;
+} chunk;
+
+typedef struct image_member {
+    size_t offset;
+    size_t length;              /* of its blob, what decoding may read */
+    uint64_t outOffset;
+    cprs_header header;
+    void* index;
+    size_t indexLen;
+    int indexMapped;
+} image_member;
+
+typedef struct image {
+    uint8_t* data;
+    size_t size;
+    int mapped;
+    image_member* members;
+    size_t memberCount;
+    uint64_t total;             /* decoded size of all members */
+    uint64_t key;
+    char* indexPath;
+    pthread_mutex_t lock;       /* guards building the indexes */
+} image;
+
+static struct {
+    char* source;
+    size_t interval;
+    uint64_t limit;
+    uint64_t used;
+    chunk* buckets[CHUNK_BUCKETS];
+    chunk* newest;
+    chunk* oldest;
+    pthread_mutex_t lock;
+} fs;
+
+static int usage(char* argv0);
+static chunk* chunk_find(uint64_t image, uint64_t number);
+static chunk* chunk_add(chunk* fresh);
+static void chunk_evict(void);
+
+/*  fs.source + path + suffix, malloc'd. */
+static char* source_path(const char* path, const char* suffix) {
+    size_t size = strlen(fs.source) + strlen(path) + strlen(suffix) + 1;
+    char* real = malloc(size);
+    if (real) {
+        snprintf(real, size, "%s%s%s", fs.source, path, suffix);
+    }
+    return real;
+}
+
+static uint64_t image_key(const struct stat* st) {
+    uint64_t fields[5] = {
+        (uint64_t)st->st_dev, (uint64_t)st->st_ino, (uint64_t)st->st_size,
+        (uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec
+    };
+    return hash_xxh64(fields, sizeof(fields));
+}
+
+/*  Splits `data` into members the way uncprs does: an exact run of two or
+    more, or else a single blob that may be followed by trailing bytes.
+    Returns the count and the malloc'd members, or 0. */
+static size_t image_members(const uint8_t* data, size_t size, image_member** membersOut, uint64_t* total) {
+    member* split = 0;
+    size_t count = members_split(data, size, &split);
+    cprs_header header;
+    if (count == 0 && cprs_header_peek(data, size, &header) != CPRS_OK) {
+        return 0;
+    }
+    /*  Member and chunk numbers share a cache key. */
+    if (count > (UINT64_MAX >> MEMBER_SHIFT)) {
+        free(split);
+        return 0;
+    }
+
+    size_t n = count ? count : 1;
+    image_member* members = calloc(n, sizeof(image_member));
+    if (!members) {
+        free(split);
+        return 0;
+    }
+    if (count) {
+        for (size_t i = 0; i < count; ++i) {
+            members[i].offset = split[i].offset;
+            members[i].length = split[i].header.compressedSize;
+            members[i].outOffset = split[i].outOffset;
+            members[i].header = split[i].header;
+        }
+    } else {
+        members[0].length = size;
+        members[0].header = header;
+    }
+    free(split);
+
+    *total = members[n - 1].outOffset + members[n - 1].header.decompressedSize;
+    *membersOut = members;
+    return n;
+}
+
+/*  Decoded size of the image at `real`, the way uncprs reads it. */
+static int image_peek(const char* real, uint64_t* total) {
+    int fd = open(real, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    struct stat st;
+    int result = -EIO;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            image_member* members;
+            if (image_members(data, st.st_size, &members, total) != 0) {
+                free(members);
+                result = 0;
+            }
+            munmap(data, st.st_size);
+        }
+    }
+    close(fd);
+    return result;
+}
+
+static image* image_open(const char* path, int* error) {
+    image* img = calloc(1, sizeof(image));
+    char* real = source_path(path, CPRS_SUFFIX);
+    struct stat st;
+    *error = -ENOMEM;
+    if (!img || !real || !(img->indexPath = source_path(path, CPRS_SUFFIX INDEX_SUFFIX))) {
+        goto fail;
+    }
+    if (stat(real, &st) != 0) {
+        *error = -errno;
+        goto fail;
+    }
+
+    *error = -EIO;
+    if (!S_ISREG(st.st_mode) || !(img->data = read_file(real, &img->size, &img->mapped))) {
+        goto fail;
+    }
+    if (img->mapped) {
+        posix_madvise(img->data, img->size, POSIX_MADV_RANDOM);
+    }
+    if (!(img->memberCount = image_members(img->data, img->size, &img->members, &img->total))) {
+        goto fail;
+    }
+
+    img->key = image_key(&st);
+    pthread_mutex_init(&img->lock, 0);
+    free(real);
+    return img;
+
+fail:
+    if (img) {
+        if (img->data) {
+            free_file(img->data, img->size, img->mapped);
+        }
+        free(img->indexPath);
+    }
+    free(img);
+    free(real);
+    return 0;
+}
+
+static void image_close(image* img) {
+    for (size_t i = 0; i < img->memberCount; ++i) {
+        image_member* m = &img->members[i];
+        if (m->index) {
+            if (m->indexMapped >= 0) {
+                free_file(m->index, m->indexLen, m->indexMapped);
+            } else {
+                free(m->index);
+            }
+        }
+    }
+    free(img->members);
+    free_file(img->data, img->size, img->mapped);
+    pthread_mutex_destroy(&img->lock);
+    free(img->indexPath);
+    free(img);
+}
+
+/*  Loads member `number`'s index: the sidecar, for an image of one
+    member, or else a copy of the cached one or one built in memory
+    (indexMapped is -1 for either). */
+static int image_index(image* img, size_t number) {
+    pthread_mutex_lock(&img->lock);
+    image_member* m = &img->members[number];
+    uint64_t key = ((uint64_t)number << MEMBER_SHIFT) | INDEX_CHUNK;
+    int result = 0;
+    if (!m->index) {
+        struct stat st;
+        if (img->memberCount == 1 && stat(img->indexPath, &st) == 0 && S_ISREG(st.st_mode)) {
+            m->index = read_file(img->indexPath, &m->indexLen, &m->indexMapped);
+        }
+        if (!m->index) {
+            pthread_mutex_lock(&fs.lock);
+            chunk* c = chunk_find(img->key, key);
+            if (c && (m->index = malloc(c->size ? c->size : 1))) {
+                memcpy(m->index, c->data, c->size);
+                m->indexLen = c->size;
+                m->indexMapped = -1;
+            }
+            pthread_mutex_unlock(&fs.lock);
+        }
+        if (!m->index) {
+            size_t bound = cprs_index_bound(m->header.decompressedSize, fs.interval);
+            uint8_t* index = malloc(bound);
+            size_t indexLen = 0;
+            if (index && cprs_index_build(img->data + m->offset, m->length, fs.interval, index, bound, &indexLen) == CPRS_OK) {
+                uint8_t* shrunk = realloc(index, indexLen ? indexLen : 1);
+                m->index = shrunk ? shrunk : index;
+                m->indexLen = indexLen;
+                m->indexMapped = -1;
+
+                chunk* fresh = calloc(1, sizeof(chunk));
+                uint8_t* copy = malloc(indexLen ? indexLen : 1);
+                if (fresh && copy) {
+                    memcpy(copy, m->index, indexLen);
+                    fresh->image = img->key;
+                    fresh->number = key;
+                    fresh->data = copy;
+                    fresh->size = indexLen;
+                    pthread_mutex_lock(&fs.lock);
+                    chunk_add(fresh);
+                    chunk_evict();
+                    pthread_mutex_unlock(&fs.lock);
+                } else {
+                    free(fresh);
+                    free(copy);
+                }
+            } else {
+                free(index);
+                result = -EIO;
+            }
+        }
+    }
+    pthread_mutex_unlock(&img->lock);
+    return result;
+}
+
+/*  Cache operations, all with fs.lock held. */
+static chunk** chunk_bucket(uint64_t image, uint64_t number) {
+    uint64_t h = (image ^ number * 0x9e3779b97f4a7c15ull) * 0xff51afd7ed558ccdull;
+    return &fs.buckets[(h >> 32) % CHUNK_BUCKETS];
+}
+
+static void chunk_unlink(chunk* c) {
+    if (c->newer) {
+        c->newer->older = c->older;
+    } else {
+        fs.newest = c->older;
+    }
+    if (c->older) {
+        c->older->newer = c->newer;
+    } else {
+        fs.oldest = c->newer;
+    }
+    c->newer = c->older = 0;
+}
+
+static void chunk_push(chunk* c) {
+    c->older = fs.newest;
+    if (fs.newest) {
+        fs.newest->newer = c;
+    } else {
+        fs.oldest = c;
+    }
+    fs.newest = c;
+}
+
+static chunk* chunk_find(uint64_t image, uint64_t number) {
+    for (chunk* c = *chunk_bucket(image, number); c; c = c->next) {
+        if (c->image == image && c->number == number) {
+            chunk_unlink(c);
+            chunk_push(c);
+            return c;
+        }
+    }
+    return 0;
+}
+
+/*  Caches `fresh`, unless another reader got a copy in first, in which
+    case that one is returned and `fresh` dropped. */
+static chunk* chunk_add(chunk* fresh) {
+    chunk* c = chunk_find(fresh->image, fresh->number);
+    if (c) {
+        free(fresh->data);
+        free(fresh);
+        return c;
+    }
+    chunk** bucket = chunk_bucket(fresh->image, fresh->number);
+    fresh->next = *bucket;
+    *bucket = fresh;
+    chunk_push(fresh);
+    fs.used += fresh->size;
+    return fresh;
+}
+
+static void chunk_evict(void) {
+    while (fs.used > fs.limit && fs.oldest) {
+        chunk* victim = fs.oldest;
+        chunk** link = chunk_bucket(victim->image, victim->number);
+        while (*link != victim) {
+            link = &(*link)->next;
+        }
+        *link = victim->next;
+        chunk_unlink(victim);
+        fs.used -= victim->size;
+        free(victim->data);
+        free(victim);
+    }
+}
+
+/*  Copies up to `size` bytes from `within` of member `part`'s chunk
+    `number`, decoding it if it isn't cached. Returns the count, or a
+    negative errno. */
+static int chunk_read(image* img, size_t part, uint64_t number, size_t within, char* buf, size_t size) {
+    image_member* m = &img->members[part];
+    uint64_t key = ((uint64_t)part << MEMBER_SHIFT) | number;
+    pthread_mutex_lock(&fs.lock);
+    chunk* c = chunk_find(img->key, key);
+    if (!c) {
+        pthread_mutex_unlock(&fs.lock);
+
+        /*  Decoded without the lock; if another reader got there first its
+            copy is kept and this one dropped. */
+        size_t start = number * CHUNK_SIZE;
+        size_t length = m->header.decompressedSize - start;
+        if (length > CHUNK_SIZE) {
+            length = CHUNK_SIZE;
+        }
+        if (start > 0 && image_index(img, part) != 0) {
+            return -EIO;
+        }
+
+        chunk* fresh = calloc(1, sizeof(chunk));
+        uint8_t* data = malloc(length ? length : 1);
+        size_t produced = 0;
+        int status = !fresh || !data ? CPRS_E_NOMEM
+            : cprs_decode_range(img->data + m->offset, m->length, m->index, m->indexLen, start, data, length, &produced);
+        if (status != CPRS_OK) {
+            free(fresh);
+            free(data);
+            return status == CPRS_E_NOMEM ? -ENOMEM : -EIO;
+        }
+        fresh->image = img->key;
+        fresh->number = key;
+        fresh->data = data;
+        fresh->size = produced;
+
+        pthread_mutex_lock(&fs.lock);
+        c = chunk_add(fresh);
+    }
+
+    size_t copied = within < c->size ? c->size - within : 0;
+    if (copied > size) {
+        copied = size;
+    }
+    memcpy(buf, c->data + within, copied);
+    /*  Only evicted after the copy, so a limit below one chunk still works. */
+    chunk_evict();
+    pthread_mutex_unlock(&fs.lock);
+    return (int)copied;
+}
+
+static int fs_getattr(const char* path, struct stat* st, struct fuse_file_info* fi) {
+    (void)fi;
+    char* real = source_path(path, "");
+    if (!real) {
+        return -ENOMEM;
+    }
+    int isDir = lstat(real, st) == 0 && S_ISDIR(st->st_mode);
+    free(real);
+    if (isDir) {
+        st->st_mode &= ~0222;
+        return 0;
+    }
+
+    if (!(real = source_path(path, CPRS_SUFFIX))) {
+        return -ENOMEM;
+    }
+    uint64_t total;
+    int result = stat(real, st) != 0 ? -errno : !S_ISREG(st->st_mode) ? -ENOENT : image_peek(real, &total);
+    free(real);
+    if (result == 0) {
+        st->st_mode = S_IFREG | (st->st_mode & 0444);
+        st->st_nlink = 1;
+        st->st_size = total;
+        st->st_blocks = (st->st_size + 511) / 512;
+    }
+    return result;
+}
+
+static int fs_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+                      struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
+    (void)offset;
+    (void)fi;
+    (void)flags;
+    char* real = source_path(path, "");
+    DIR* dir = real ? opendir(real) : 0;
+    if (!dir) {
+        int result = real ? -errno : -ENOMEM;
+        free(real);
+        return result;
+    }
+
+    filler(buf, ".", 0, 0, 0);
+    filler(buf, "..", 0, 0, 0);
+
+    struct dirent* d;
+    while ((d = readdir(dir)) != 0) {
+        if (d->d_name[0] == '.') {
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(dir), d->d_name, &st, 0) != 0) {
+            continue;
+        }
+        size_t length = strlen(d->d_name);
+        size_t suffix = sizeof(CPRS_SUFFIX) - 1;
+        if (S_ISDIR(st.st_mode)) {
+            filler(buf, d->d_name, 0, 0, 0);
+        } else if (S_ISREG(st.st_mode) && length > suffix
+                   && strcmp(d->d_name + length - suffix, CPRS_SUFFIX) == 0) {
+            char name[NAME_MAX + 1];
+            memcpy(name, d->d_name, length - suffix);
+            name[length - suffix] = 0;
+            filler(buf, name, 0, 0, 0);
+        }
+    }
+
+    closedir(dir);
+    free(real);
+    return 0;
+}
+
+static int fs_open(const char* path, struct fuse_file_info* fi) {
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        return -EROFS;
+    }
+
+    int error;
+    image* img = image_open(path, &error);
+    if (!img) {
+        return error;
+    }
+    fi->fh = (uint64_t)(uintptr_t)img;
+    fi->keep_cache = 1;
+    return 0;
+}
+
+static int fs_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    (void)path;
+    image* img = (image*)(uintptr_t)fi->fh;
+    uint64_t total = img->total;
+    if (offset < 0 || (uint64_t)offset >= total) {
+        return 0;
+    }
+    if (size > total - offset) {
+        size = total - offset;
+    }
+
+    /*  The last member starting at or before the offset holds it. */
+    size_t low = 0;
+    size_t high = img->memberCount;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (img->members[mid].outOffset <= (uint64_t)offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    size_t part = low;
+    size_t done = 0;
+    while (done < size) {
+        uint64_t pos = offset + done;
+        while (part + 1 < img->memberCount && img->members[part + 1].outOffset <= pos) {
+            ++part;
+        }
+        image_member* m = &img->members[part];
+        uint64_t within = pos - m->outOffset;
+        size_t want = size - done;
+        if (want > m->header.decompressedSize - within) {
+            want = m->header.decompressedSize - within;
+        }
+        int n = chunk_read(img, part, within / CHUNK_SIZE, within % CHUNK_SIZE, buf + done, want);
+        if (n < 0) {
+            return done ? (int)done : n;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return (int)done;
+}
+
+static int fs_release(const char* path, struct fuse_file_info* fi) {
+    (void)path;
+    image_close((image*)(uintptr_t)fi->fh);
+    return 0;
+}
+
+static void* fs_init(struct fuse_conn_info* conn, struct fuse_config* cfg) {
+    (void)conn;
+    /*  The images aren't expected to change under the mount. */
+    cfg->kernel_cache = 1;
+    return 0;
+}
+
+static void fs_destroy(void* data) {
+    (void)data;
+    pthread_mutex_lock(&fs.lock);
+    fs.limit = 0;
+    chunk_evict();
+    pthread_mutex_unlock(&fs.lock);
+}
+
+static const struct fuse_operations operations = {
+    .getattr = fs_getattr,
+    .readdir = fs_readdir,
+    .open = fs_open,
+    .read = fs_read,
+    .release = fs_release,
+    .init = fs_init,
+    .destroy = fs_destroy,
+};
+
+int main(int argc, char** argv) {
+    fs.interval = CPRS_INDEX_INTERVAL;
+    fs.limit = CHUNK_CACHE_LIMIT;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-' && argv[argi][1] == '-'; ++argi) {
+        if (strcmp(argv[argi], "--cache-size") == 0 && argi + 1 < argc) {
+            fs.limit = parse_size(argv[++argi]);
+            if (fs.limit == 0) {
+                return usage(argv[0]);
+            }
+        } else if (strcmp(argv[argi], "--index-interval") == 0 && argi + 1 < argc) {
+            fs.interval = (size_t)parse_size(argv[++argi]);
+            if (fs.interval == 0 || fs.interval > UINT32_MAX) {
+                return usage(argv[0]);
+            }
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    if (argc - argi < 2) {
+        return usage(argv[0]);
+    }
+
+    /*  FUSE changes directory once it is running. */
+    if (!(fs.source = realpath(argv[argi], 0))) {
+        fprintf(stderr, "Error: Unable to open directory %s\n", argv[argi]);
+        return ERR_CPRS_FILE;
+    }
+    pthread_mutex_init(&fs.lock, 0);
+
+    /*  Everything from the mount point on goes to FUSE, mounted read-only. */
+    int fuseArgc = 0;
+    char** fuseArgv = malloc((argc - argi + 3) * sizeof(char*));
+    if (!fuseArgv) {
+        fprintf(stderr, "Error: Unable to allocate arguments\n");
+        return ERR_USAGE;
+    }
+    fuseArgv[fuseArgc++] = argv[0];
+    for (int i = argi + 1; i < argc; ++i) {
+        fuseArgv[fuseArgc++] = argv[i];
+    }
+    fuseArgv[fuseArgc++] = "-oro";
+    fuseArgv[fuseArgc] = 0;
+
+    int result = fuse_main(fuseArgc, fuseArgv, &operations, 0);
+
+    free(fuseArgv);
+    pthread_mutex_destroy(&fs.lock);
+    free(fs.source);
+    return result;
+}
+
+static int usage(char* argv0) {
+    fprintf(stderr, "Usage: %s [--cache-size BYTES] [--index-interval N] SOURCEDIR MOUNTPOINT [FUSE OPTIONS]\n", argv0);
+    return ERR_USAGE;
+}
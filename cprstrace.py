@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+
+# seag-cprs
+# Copyright (C) 2024  wilszdev
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+# Reads the token traces `uncprs --trace` writes: a 16-byte header
+# (signature, record size, compressedSize, decompressedSize) followed by
+# one fixed-width record per token, laid out as cprs_decode_trace()
+# describes in cprs.h. Prints them one per line, or with --summary how
+# often each kind of token and each CPRS_TABLE row came up.
+
+
+import struct
+import sys
+
+
+ERR_OK        = 0x00
+ERR_USAGE     = 0x01
+ERR_CPRS_FILE = 0x02
+
+TRACE_SIG = b'CPRT'
+RECORD = struct.Struct('<IBBHII')
+KINDS = ('literal', 'run', 'match', 'end')
+
+
+def main():
+    args = sys.argv[1:]
+    summary = bool(args) and args[0] == '--summary'
+    if summary:
+        args = args[1:]
+    if len(args) != 1:
+        sys.stderr.write(f'Usage: {sys.argv[0]} [--summary] TRACEFILE\n')
+        return ERR_USAGE
+
+    try:
+        traceFile = sys.stdin.buffer if args[0] == '-' else open(args[0], 'rb')
+    except OSError:
+        sys.stderr.write(f'Error: Unable to open file {args[0]}\n')
+        return ERR_CPRS_FILE
+
+    with traceFile:
+        header = traceFile.read(16)
+        if len(header) != 16 or header[:4] != TRACE_SIG:
+            sys.stderr.write(f'Error: {args[0]} is not a token trace\n')
+            return ERR_CPRS_FILE
+        recordSize, compressedSize, decompressedSize = struct.unpack_from('<III', header, 4)
+        if recordSize != RECORD.size:
+            sys.stderr.write(f'Error: Unsupported record size {recordSize}\n')
+            return ERR_CPRS_FILE
+
+        print(f'# compressedSize {compressedSize} decompressedSize {decompressedSize}')
+        records = read_records(traceFile)
+        if summary:
+            print_summary(records)
+        else:
+            print_records(records)
+
+    return ERR_OK
+
+
+def read_records(traceFile):
+    """Yields (bitPos, kind, group, code, length, distance, outPos)."""
+    while chunk := traceFile.read(RECORD.size * 4096):
+        usable = len(chunk) - len(chunk) % RECORD.size
+        for low, high, kindRows, length, distance, outPos in RECORD.iter_unpack(chunk[:usable]):
+            yield (high << 32 | low, kindRows & 3, kindRows >> 2 & 3, kindRows >> 4,
+                   length, distance, outPos)
+
+
+def print_records(records):
+    write = sys.stdout.write
+    write('# BITPOS\tOUTPOS\tKIND\tLENGTH\tDISTANCE\tGROUP\tCODE\n')
+    for bitPos, kind, group, code, length, distance, outPos in records:
+        if kind == 0:
+            write(f'{bitPos}\t{outPos}\tliteral\t0x{length:02x}\n')
+        else:
+            write(f'{bitPos}\t{outPos}\t{KINDS[kind]}\t{length}\t{distance}\t{group}\t{code}\n')
+
+
+def print_summary(records):
+    kinds = [0] * 4
+    kindBytes = [0] * 4
+    rows = [0] * 20
+    rowBytes = [0] * 20
+    for bitPos, kind, group, code, length, distance, outPos in records:
+        kinds[kind] += 1
+        if kind == 0:
+            kindBytes[0] += 1
+            continue
+        rows[group] += 1
+        rows[4 + code] += 1
+        if kind != 3:
+            kindBytes[kind] += length
+            rowBytes[group] += length
+            rowBytes[4 + code] += length
+
+    print('# KIND\tTOKENS\tBYTES')
+    for kind in range(4):
+        print(f'{KINDS[kind]}\t{kinds[kind]}\t{kindBytes[kind]}')
+    print('# ROW\tTOKENS\tBYTES')
+    for row in range(20):
+        name = f'length group {row}' if row < 4 else f'distance code {row - 4}'
+        print(f'{row} ({name})\t{rows[row]}\t{rowBytes[row]}')
+
+
+if __name__ == '__main__':
+    exit(main())
@@ -0,0 +1,224 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "uncprs.h"
+
+/*  Packs a file into a CPRS blob, the inverse of uncprs. Exit codes are
+    the same ERR_* bits, with ERR_UNCPRS standing for a failed encode.
+
+    With --jobs or --block-size the input is cut into blocks that are
+    compressed concurrently, each with its own match finder, into
+    independent members written back to back. uncprs decodes such a file
+    member by member on its pool as well, but the MCU's own decompressor
+    doesn't: it decodes the first member and exits 0, so such a file is
+    only for uncprs, and a warning says so. Matches can't reach across a
+    block boundary, which is what the ratio loses; --compare also does the
+    single-stream encode and reports the difference. */
+
+#define BLOCK_SIZE_DEFAULT ((size_t)4 << 20)
+
+typedef struct block_job {
+    const uint8_t* in;
+    size_t inSize;
+    size_t blockSize;
+    uint8_t* out;
+    size_t blockBound;
+    size_t* sizes;
+    int* statuses;
+    int level;
+} block_job;
+
+static int usage(char* argv0);
+static size_t encode_blocks(const uint8_t* in, size_t inSize, uint8_t* out, size_t blockSize, int level, int jobs);
+static void block_task(void* context, size_t index, scratch_buffer* scratch);
+static void compare_single(const uint8_t* in, size_t inSize, int level, size_t blocks, size_t outSize);
+
+int main(int argc, char** argv) {
+    int level = CPRS_LEVEL_DEFAULT;
+    int jobs = 0;
+    size_t blockSize = 0;
+    int compare = 0;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-' && argv[argi][1] == '-'; ++argi) {
+        if (strcmp(argv[argi], "--fast") == 0) {
+            level = CPRS_LEVEL_FAST;
+        } else if (strcmp(argv[argi], "--best") == 0) {
+            level = CPRS_LEVEL_BEST;
+        } else if (strcmp(argv[argi], "--level") == 0 && argi + 1 < argc) {
+            level = atoi(argv[++argi]);
+            if (level < CPRS_LEVEL_FAST || level > CPRS_LEVEL_BEST) {
+                return usage(argv[0]);
+            }
+        } else if (strcmp(argv[argi], "--jobs") == 0 && argi + 1 < argc) {
+            jobs = atoi(argv[++argi]);
+            if (!blockSize) {
+                blockSize = BLOCK_SIZE_DEFAULT;
+            }
+        } else if (strcmp(argv[argi], "--block-size") == 0 && argi + 1 < argc) {
+            uint64_t size = parse_size(argv[++argi]);
+            if (size == 0 || size > UINT32_MAX) {
+                return usage(argv[0]);
+            }
+            blockSize = (size_t)size;
+        } else if (strcmp(argv[argi], "--compare") == 0) {
+            compare = 1;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+
+    int positional = argc - argi;
+    if (positional != 1 && positional != 2) {
+        return usage(argv[0]);
+    }
+
+    char* inPath = (argv[argi][0] == '-' && argv[argi][1] == 0) ? 0 : argv[argi];
+    char* outPath = positional == 2 ? argv[argi + 1] : 0;
+
+    size_t inSize = 0;
+    int mapped = 0;
+    void* in = read_file(inPath, &inSize, &mapped);
+    if (!in) {
+        return ERR_CPRS_FILE;
+    }
+
+    size_t blocks = blockSize && inSize > blockSize ? (inSize + blockSize - 1) / blockSize : 1;
+    size_t bound = blocks > 1 ? blocks * cprs_encode_bound(blockSize) : cprs_encode_bound(inSize);
+    uint8_t* out = malloc(bound);
+    if (!out) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", bound);
+        free_file(in, inSize, mapped);
+        return ERR_UNCPRS;
+    }
+
+    size_t outSize = 0;
+    int failed = 0;
+    if (blocks > 1) {
+        outSize = encode_blocks(in, inSize, out, blockSize, level, jobs);
+        failed = outSize == (size_t)-1;
+    } else {
+        int status = cprs_encode(in, inSize, out, bound, &outSize, level);
+        if (status != CPRS_OK) {
+            fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+            failed = 1;
+        }
+    }
+
+    if (!failed && compare) {
+        compare_single(in, inSize, level, blocks, outSize);
+    }
+    free_file(in, inSize, mapped);
+
+    if (failed) {
+        free(out);
+        return ERR_UNCPRS;
+    }
+
+    int success = write_file(outPath, out, outSize);
+    free(out);
+    if (success && blocks > 1) {
+        fprintf(stderr, "Warning: wrote %zu members; the original decompressor only decodes the first "
+                "(use uncprs, or leave out --jobs and --block-size for a single blob)\n", blocks);
+    }
+    return success ? ERR_OK : ERR_OUT_FILE;
+}
+
+/*  Returns the size of the members, back to back at the start of `out`,
+    or (size_t)-1 after reporting a failed block. */
+static size_t encode_blocks(const uint8_t* in, size_t inSize, uint8_t* out, size_t blockSize, int level, int jobs) {
+    size_t count = (inSize + blockSize - 1) / blockSize;
+    block_job job = { in, inSize, blockSize, out, cprs_encode_bound(blockSize), 0, 0, level };
+    job.sizes = malloc(count * sizeof(size_t));
+    job.statuses = malloc(count * sizeof(int));
+    if (!job.sizes || !job.statuses) {
+        fprintf(stderr, "Error: Unable to allocate block state\n");
+        free(job.sizes);
+        free(job.statuses);
+        return (size_t)-1;
+    }
+
+    pool_run(count, jobs, block_task, &job);
+
+    size_t outSize = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (job.statuses[i] != CPRS_OK) {
+            fprintf(stderr, "Error: block %zu at 0x%08zx: %s\n", i, i * blockSize,
+                    cprs_strerror(job.statuses[i]));
+            outSize = (size_t)-1;
+            break;
+        }
+        if (outSize != i * job.blockBound) {
+            memmove(out + outSize, out + i * job.blockBound, job.sizes[i]);
+        }
+        outSize += job.sizes[i];
+    }
+
+    free(job.sizes);
+    free(job.statuses);
+    return outSize;
+}
+
+static void block_task(void* context, size_t index, scratch_buffer* scratch) {
+    block_job* job = context;
+    size_t offset = index * job->blockSize;
+    size_t size = job->inSize - offset < job->blockSize ? job->inSize - offset : job->blockSize;
+    (void)scratch;
+
+    job->statuses[index] = cprs_encode(job->in + offset, size, job->out + index * job->blockBound,
+                                       job->blockBound, &job->sizes[index], job->level);
+}
+
+/*  Encodes `in` as one stream too and reports what splitting it cost. */
+static void compare_single(const uint8_t* in, size_t inSize, int level, size_t blocks, size_t outSize) {
+    size_t bound = cprs_encode_bound(inSize);
+    uint8_t* single = malloc(bound);
+    if (!single) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", bound);
+        return;
+    }
+
+    size_t singleSize = 0;
+    int status = cprs_encode(in, inSize, single, bound, &singleSize, level);
+    if (status == CPRS_OK) {
+        fprintf(stderr, "%zu member%s: %zu bytes, single stream: %zu bytes (%+.2f%%)\n",
+                blocks, blocks == 1 ? "" : "s", outSize, singleSize,
+                100.0 * ((double)outSize - (double)singleSize) / (double)singleSize);
+    } else {
+        fprintf(stderr, "%zu member%s: %zu bytes, single stream: %s\n",
+                blocks, blocks == 1 ? "" : "s", outSize, cprs_strerror(status));
+    }
+    free(single);
+}
+
+static int usage(char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [--fast | --best | --level 1-9] INPUTFILE [OUTPUTFILE]\n"
+            "       %s [--fast | --best | --level 1-9] [--jobs N] [--block-size BYTES] [--compare] INPUTFILE [OUTPUTFILE]\n"
+            "\n"
+            "With --jobs or --block-size an input larger than a block is written as several\n"
+            "members, which uncprs decodes but the original decompressor doesn't: it decodes\n"
+            "the first block only and still exits 0.\n",
+            argv0, argv0);
+    return ERR_USAGE;
+}
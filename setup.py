@@ -0,0 +1,45 @@
+# seag-cprs
+# Copyright (C) 2024  wilszdev
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Builds the _uncprs_native extension that uncprs.py uses when present:
+#     python3 setup.py build_ext --inplace    (or: make python)
+
+import os
+import subprocess
+
+from setuptools import Extension, setup
+from setuptools.command.build_ext import build_ext
+
+
+class BuildExt(build_ext):
+    # cprs_lut.h is generated by cprs_gentable, which make knows how to do.
+    def run(self):
+        if not os.path.exists('cprs_lut.h'):
+            subprocess.check_call(['make', 'cprs_lut.h'])
+        super().run()
+
+
+setup(
+    name='uncprs',
+    version='1.0',
+    py_modules=['uncprs'],
+    ext_modules=[Extension(
+        '_uncprs_native',
+        sources=['uncprs_native.c', 'cprs.c', 'cprs_table.c'],
+        extra_compile_args=['-std=c99', '-O2'],
+    )],
+    cmdclass={'build_ext': BuildExt},
+)
@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+
+# seag-cprs
+# Copyright (C) 2024  wilszdev
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+# `make check`: round-trips mkcprs at every level through uncprs and
+# uncprs.py, walks a multi-member file in every mode that takes one, runs
+# both through --batch, --cache, the daemon and cprsfs, then feeds the
+# decoders damaged blobs. A damaged blob may still decode (a flipped
+# literal is just a different byte), but no decoder may crash on it, the
+# ones that can't be decoded must fail with ERR_UNCPRS, and the
+# _uncprs_native extension and the pure-Python decoder must agree on all
+# of them.
+
+import contextlib
+import io
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+ERR_OK     = 0x00
+ERR_UNCPRS = 0x04
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+UNCPRS = os.path.join(ROOT, 'uncprs')
+MKCPRS = os.path.join(ROOT, 'mkcprs')
+CPRSFS_CHECK = os.path.join(ROOT, 'cprsfs_check')
+UNCPRS_PY = [sys.executable, os.path.join(ROOT, 'uncprs.py')]
+
+sys.path.insert(0, ROOT)
+import uncprs
+
+failures = 0
+
+
+def check(ok, what):
+    global failures
+    if not ok:
+        failures += 1
+        print(f'FAIL {what}')
+
+
+def run(args, stdin=None):
+    return subprocess.run(args, input=stdin, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+
+
+def samples():
+    rng = random.Random(1)
+    text = open(os.path.join(ROOT, 'README.md'), 'rb').read()
+    words = text.split()
+    yield 'empty', b''
+    yield 'byte', b'x'
+    yield 'text', text
+    yield 'zeros', bytes(100000)
+    yield 'random', bytes(rng.getrandbits(8) for _ in range(30000))
+    yield 'runs', b''.join(bytes([rng.getrandbits(8)]) * rng.randint(1, 300) for _ in range(1000))
+    yield 'words', b' '.join(rng.choice(words) for _ in range(40000))
+    yield 'binary', open(MKCPRS, 'rb').read()
+
+
+def roundtrip(work):
+    for name, data in samples():
+        source = os.path.join(work, name)
+        with open(source, 'wb') as f:
+            f.write(data)
+
+        for level in range(1, 10):
+            blob = f'{source}.{level}.cprs'
+            result = run([MKCPRS, '--level', str(level), source, blob])
+            check(result.returncode == ERR_OK, f'mkcprs --level {level} {name}')
+            if result.returncode != ERR_OK:
+                continue
+
+            result = run([UNCPRS, blob])
+            check(result.returncode == ERR_OK and result.stdout == data, f'uncprs {name} level {level}')
+
+            # An empty output reads as a failure to uncprs.py.
+            if data:
+                result = run(UNCPRS_PY + [blob])
+                check(result.returncode == ERR_OK and result.stdout == data, f'uncprs.py {name} level {level}')
+
+    blocks = os.path.join(work, 'words.blocks.cprs')
+    source = os.path.join(work, 'words')
+    result = run([MKCPRS, '--jobs', '3', '--block-size', '65536', source, blocks])
+    check(result.returncode == ERR_OK, 'mkcprs --jobs')
+    result = run([UNCPRS, blocks])
+    check(result.returncode == ERR_OK and result.stdout == open(source, 'rb').read(), 'uncprs on mkcprs --jobs output')
+
+
+def members(work):
+    source = os.path.join(work, 'words')
+    data = open(source, 'rb').read()
+    blocks = os.path.join(work, 'words.blocks.cprs')
+    single = os.path.join(work, 'words.6.cprs')
+
+    result = run([UNCPRS, '--stream', blocks])
+    check(result.returncode == ERR_OK and result.stdout == data, 'uncprs --stream on members')
+    result = run([UNCPRS, '--stream', '-'], open(blocks, 'rb').read() + b'trailing')
+    check(result.returncode == ERR_OK and result.stdout == data, 'uncprs --stream on members with trailing bytes')
+    result = run([UNCPRS, '--stream', '-'], open(blocks, 'rb').read()[:65536 + 7])
+    check(result.returncode == ERR_UNCPRS, 'uncprs --stream on truncated members')
+
+    fields = run([UNCPRS, '--verify', blocks]).stdout.split(b'\t')
+    expected = [b'0', str(os.path.getsize(blocks)).encode(), str(len(data)).encode(), str(len(data)).encode()]
+    check(fields[:4] == expected and fields[4] == run([UNCPRS, '--verify', single]).stdout.split(b'\t')[4],
+          'uncprs --verify on members')
+
+    result = run([UNCPRS, '--diff', blocks, single])
+    check(result.returncode == ERR_OK and result.stdout == b'', 'uncprs --diff members against a single blob')
+
+    # Modes that only take a single blob must refuse, not decode the first member.
+    for args in (['--head', '10'], ['--stats'], ['--in-place'], ['--range', '0:10'],
+                 ['--trace', os.path.join(work, 'trace')], ['--index', os.path.join(work, 'index')]):
+        result = run([UNCPRS] + args + [blocks])
+        check(result.returncode == ERR_UNCPRS, f'uncprs {args[0]} on members exited {result.returncode}')
+
+
+def outputs(work):
+    # Outputs are written through links, the way fopen() does.
+    data = open(os.path.join(work, 'words'), 'rb').read()
+    blob = os.path.join(work, 'words.6.cprs')
+    target = os.path.join(work, 'target')
+    link = os.path.join(work, 'link')
+    hard = os.path.join(work, 'hard')
+    with open(target, 'wb') as f:
+        f.write(b'old')
+    os.symlink(target, link)
+    os.link(target, hard)
+
+    for path in (link, hard):
+        result = run([UNCPRS, blob, path])
+        check(result.returncode == ERR_OK, f'uncprs into {os.path.basename(path)}')
+    check(os.path.islink(link) and os.stat(hard).st_nlink == 2, 'uncprs keeps output links')
+    check(open(target, 'rb').read() == data, 'uncprs writes through output links')
+
+
+def modes(work):
+    # --batch on the io_uring pipeline and on the pool, --cache, and the
+    # daemon, each on a single blob and on members.
+    data = open(os.path.join(work, 'words'), 'rb').read()
+    inputs = [os.path.join(work, name) for name in ('words.6.cprs', 'words.blocks.cprs', 'words.1.cprs')]
+
+    for depth in ('8', '0'):
+        pairs = []
+        for i, path in enumerate(inputs):
+            pairs += [path, os.path.join(work, f'batch.{depth}.{i}')]
+        result = run([UNCPRS, '--batch', '--jobs', '2', '--queue-depth', depth] + pairs)
+        check(result.returncode == ERR_OK, f'uncprs --batch --queue-depth {depth} exited {result.returncode}')
+        for out in pairs[1::2]:
+            check(open(out, 'rb').read() == data, f'uncprs --batch --queue-depth {depth} {os.path.basename(out)}')
+
+    cache = os.path.join(work, 'cache')
+    out = os.path.join(work, 'cached')
+    for attempt in ('miss', 'hit'):
+        result = run([UNCPRS, '--cache', cache, inputs[0], out])
+        check(result.returncode == ERR_OK and open(out, 'rb').read() == data, f'uncprs --cache {attempt}')
+    entries = [os.path.join(cache, name) for name in os.listdir(cache)]
+    check(len(entries) == 1, 'uncprs --cache keeps one entry per input')
+
+    # A hit is served from the entry, so a changed entry shows in the output...
+    with open(entries[0], 'r+b') as f:
+        f.seek(-1, os.SEEK_END)
+        last = f.read(1)
+        f.seek(-1, os.SEEK_END)
+        f.write(b'!' if last != b'!' else b'?')
+    result = run([UNCPRS, '--cache', cache, inputs[0], out])
+    check(result.returncode == ERR_OK and open(out, 'rb').read()[:-1] == data[:-1]
+          and open(out, 'rb').read() != data, 'uncprs --cache served a hit from the entry')
+    # ...but not for an input whose name merely collides with it.
+    run([UNCPRS, '--cache', cache, inputs[2], out])
+    other = [os.path.join(cache, name) for name in os.listdir(cache)]
+    other.remove(entries[0])
+    shutil.copy(entries[0], other[0])
+    result = run([UNCPRS, '--cache', cache, inputs[2], out])
+    check(result.returncode == ERR_OK and open(out, 'rb').read() == data, 'uncprs --cache rejects a colliding entry')
+
+    socket = os.path.join(work, 'daemon.sock')
+    daemon = subprocess.Popen([UNCPRS, '--daemon', socket, '--jobs', '2'],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    try:
+        for _ in range(500):
+            if os.path.exists(socket) or daemon.poll() is not None:
+                break
+            time.sleep(0.01)
+        for i, path in enumerate(inputs):
+            out = os.path.join(work, f'connect.{i}')
+            result = run([UNCPRS, '--connect', socket, path, out])
+            check(result.returncode == ERR_OK and open(out, 'rb').read() == data,
+                  f'uncprs --connect {os.path.basename(path)} exited {result.returncode}')
+        result = run([UNCPRS, '--connect', socket, inputs[1]])
+        check(result.returncode == ERR_OK and result.stdout == data, 'uncprs --connect to stdout')
+        result = run([UNCPRS, '--daemon', socket])
+        check(result.returncode != ERR_OK, 'uncprs --daemon refuses a socket in use')
+        check(daemon.poll() is None, 'uncprs --daemon still running')
+    finally:
+        daemon.terminate()
+        daemon.wait()
+
+
+def cprsfs(work):
+    # cprsfs against the stub libfuse, which reads every file in the view
+    # back to front and then front to back.
+    data = open(os.path.join(work, 'words'), 'rb').read()
+    source = os.path.join(work, 'images')
+    out = os.path.join(work, 'view')
+    os.mkdir(source)
+    os.mkdir(out)
+    os.mkdir(os.path.join(source, 'directory'))
+    shutil.copy(os.path.join(work, 'words.6.cprs'), os.path.join(source, 'single.cprs'))
+    shutil.copy(os.path.join(work, 'words.blocks.cprs'), os.path.join(source, 'members.cprs'))
+    with open(os.path.join(source, 'notes.txt'), 'wb') as f:
+        f.write(b'not an image')
+
+    for args in ([], ['--cache-size', '1']):
+        result = run([CPRSFS_CHECK] + args + [source, out])
+        check(result.returncode == ERR_OK, f'cprsfs {args} exited {result.returncode}: {result.stderr}')
+        check(sorted(os.listdir(out)) == ['members', 'single'], 'cprsfs shows images only')
+        for name in ('single', 'members'):
+            check(open(os.path.join(out, name), 'rb').read() == data, f'cprsfs {args} {name}')
+            os.unlink(os.path.join(out, name))
+
+
+def decoders(blob):
+    yield 'uncprs', run([UNCPRS, blob])
+    yield 'uncprs --stream', run([UNCPRS, '--stream', blob])
+    yield 'uncprs --speculative', run([UNCPRS, '--speculative', '--jobs', '4', blob])
+    yield 'uncprs.py', run(UNCPRS_PY + [blob])
+
+
+def replace(data, offset, value):
+    return data[:offset] + value + data[offset + len(value):]
+
+
+def corrupt(work):
+    blob = open(os.path.join(work, 'words.6.cprs'), 'rb').read()
+    decompressedSize, = struct.unpack_from('<I', blob, 8)
+    rng = random.Random(2)
+
+    # Blobs that must be rejected, and by which decoders. The stream
+    # decoder never sees the end of its input, so it can't check the
+    # length or the trailing signature.
+    everyone = ('uncprs', 'uncprs --stream', 'uncprs --speculative', 'uncprs.py')
+    framed = ('uncprs', 'uncprs --speculative', 'uncprs.py')
+    sized = framed
+    broken = [
+        ('misaligned', blob + b'\0', framed),
+        ('too small', b'CPRS' + bytes(8) + b'CPRS', everyone),
+        ('bad signature', replace(blob, 0, b'CPRX'), everyone),
+        ('bad trailing signature', replace(blob, len(blob) - 4, b'CPRX'), framed),
+        ('truncated payload', blob[:len(blob) // 2 // 4 * 4] + b'CPRS', everyone),
+        ('small decompressedSize', replace(blob, 8, struct.pack('<I', decompressedSize // 2)), sized),
+        ('zero payload', blob[:12] + bytes(len(blob) - 16) + b'CPRS', everyone),
+    ]
+    for name, data, rejecting in broken:
+        path = os.path.join(work, 'broken.cprs')
+        with open(path, 'wb') as f:
+            f.write(data)
+        for decoder, result in decoders(path):
+            expected = (ERR_UNCPRS,) if decoder in rejecting else (ERR_OK, ERR_UNCPRS)
+            check(result.returncode in expected, f'{decoder} on {name} blob exited {result.returncode}')
+
+    # Damage that may or may not survive decoding, as long as nothing crashes.
+    damaged = []
+    for i in range(30):
+        data = bytearray(blob)
+        for _ in range(rng.randint(1, 8)):
+            data[rng.randrange(12, len(data) - 4)] ^= 1 << rng.randrange(8)
+        damaged.append((f'bit flips {i}', bytes(data)))
+    for i in range(10):
+        tail = bytes(rng.getrandbits(8) for _ in range(rng.randrange(1, 64) * 4))
+        damaged.append((f'garbage tail {i}', blob[:-4] + tail + b'CPRS'))
+    damaged.append(('large decompressedSize', replace(blob, 8, struct.pack('<I', decompressedSize + 4096))))
+
+    for name, data in damaged:
+        path = os.path.join(work, 'damaged.cprs')
+        with open(path, 'wb') as f:
+            f.write(data)
+        for decoder, result in decoders(path):
+            check(result.returncode in (ERR_OK, ERR_UNCPRS), f'{decoder} on {name} exited {result.returncode}')
+
+    for i in range(300):
+        data = bytearray(blob)
+        for _ in range(rng.randint(1, 4)):
+            data[rng.randrange(12, len(data) - 4)] ^= 1 << rng.randrange(8)
+        damaged.append((f'native bit flips {i}', bytes(data)))
+    native([(name, data) for name, data, _ in broken] + damaged + [('intact', blob)])
+
+
+def native(blobs):
+    # The extension and the pure-Python decoder must give the same bytes,
+    # or both fail, whatever the blob.
+    if uncprs._native is None:
+        check(False, 'the _uncprs_native extension is built')
+        return
+    for name, data in blobs:
+        with contextlib.redirect_stderr(io.StringIO()):
+            try:
+                fast = bytes(uncprs._native.decompress(data))
+            except ValueError:
+                fast = None
+            slow = uncprs.decompress_python(data)
+        check(fast == (None if slow is None else bytes(slow)), f'native and pure-Python decoders differ on {name}')
+
+
+def main():
+    work = tempfile.mkdtemp(prefix='cprs-check-')
+    try:
+        roundtrip(work)
+        members(work)
+        outputs(work)
+        modes(work)
+        cprsfs(work)
+        corrupt(work)
+    finally:
+        shutil.rmtree(work)
+
+    if failures:
+        print(f'{failures} check(s) failed')
+        return 1
+    print('all checks passed')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
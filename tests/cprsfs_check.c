@@ -0,0 +1,151 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*  Stands in for libfuse's fuse_main() so that cprsfs can be checked
+    without mounting anything: `cprsfs_check SOURCEDIR OUTDIR` lists the
+    top of the view, reads every file in it back to front in uneven
+    pieces, and writes what it read to OUTDIR/NAME. Each file is then
+    opened again and read front to back, which must give the same bytes.
+    tests/check.py compares the outputs with the originals. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fuse.h"
+
+#define MAX_NAMES   64
+#define MAX_READ    200000
+
+typedef struct listing {
+    char* names[MAX_NAMES];
+    int count;
+} listing;
+
+static int fill(void* buf, const char* name, const struct stat* st, off_t offset,
+                enum fuse_fill_dir_flags flags) {
+    (void)st;
+    (void)offset;
+    (void)flags;
+    listing* l = buf;
+    if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0 && l->count < MAX_NAMES) {
+        l->names[l->count++] = strdup(name);
+    }
+    return 0;
+}
+
+/*  Reads all of `path`, in random pieces from the end, or in order.
+    Returns 0 once `size` bytes have been read and no more follow. */
+static int read_all(const struct fuse_operations* op, const char* path, char* out, size_t size, int backwards) {
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = O_RDONLY;
+    int result = op->open(path, &fi);
+    if (result != 0) {
+        fprintf(stderr, "Error: open %s: %s\n", path, strerror(-result));
+        return -1;
+    }
+
+    size_t low = 0;
+    size_t high = size;
+    while (low < high) {
+        size_t length = (size_t)rand() % MAX_READ + 1;
+        if (length > high - low) {
+            length = high - low;
+        }
+        size_t offset = backwards ? high - length : low;
+        int n = op->read(path, out + offset, length, offset, &fi);
+        if (n != (int)length) {
+            fprintf(stderr, "Error: read %s at %zu returned %d, not %zu\n", path, offset, n, length);
+            result = -1;
+            break;
+        }
+        if (backwards) {
+            high -= length;
+        } else {
+            low += length;
+        }
+    }
+
+    char extra;
+    if (result == 0 && op->read(path, &extra, 1, size, &fi) != 0) {
+        fprintf(stderr, "Error: read %s past its size\n", path);
+        result = -1;
+    }
+    op->release(path, &fi);
+    return result;
+}
+
+int fuse_main(int argc, char** argv, const struct fuse_operations* op, void* data) {
+    (void)data;
+    if (argc < 2) {
+        return 1;
+    }
+
+    struct fuse_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    op->init(0, &cfg);
+
+    listing l;
+    l.count = 0;
+    int result = op->readdir("/", &l, fill, 0, 0, 0);
+    srand(1);
+
+    for (int i = 0; result == 0 && i < l.count; ++i) {
+        char path[1024];
+        snprintf(path, sizeof(path), "/%s", l.names[i]);
+        struct stat st;
+        if ((result = op->getattr(path, &st, 0)) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        size_t size = st.st_size;
+        char* first = malloc(size ? size : 1);
+        char* second = malloc(size ? size : 1);
+        if (!first || !second) {
+            result = -ENOMEM;
+        } else if (read_all(op, path, first, size, 1) != 0 || read_all(op, path, second, size, 0) != 0) {
+            result = -EIO;
+        } else if (memcmp(first, second, size) != 0) {
+            fprintf(stderr, "Error: %s read differently the second time\n", path);
+            result = -EIO;
+        } else {
+            char out[1024];
+            snprintf(out, sizeof(out), "%s/%s", argv[1], l.names[i]);
+            FILE* f = fopen(out, "wb");
+            if (!f || fwrite(first, 1, size, f) != size) {
+                fprintf(stderr, "Error: Unable to write %s\n", out);
+                result = -EIO;
+            }
+            if (f) {
+                fclose(f);
+            }
+        }
+        free(first);
+        free(second);
+    }
+
+    for (int i = 0; i < l.count; ++i) {
+        free(l.names[i]);
+    }
+    op->destroy(0);
+    return result != 0;
+}
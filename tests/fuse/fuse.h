@@ -0,0 +1,66 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*  The part of libfuse 3's high-level API that cprsfs uses, for building
+    it against tests/cprsfs_check.c instead of a real mount. */
+
+#ifndef CPRS_TEST_FUSE_H
+#define CPRS_TEST_FUSE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+struct fuse_file_info {
+    int flags;
+    unsigned int keep_cache : 1;
+    uint64_t fh;
+};
+
+struct fuse_conn_info {
+    unsigned int want;
+};
+
+struct fuse_config {
+    int kernel_cache;
+};
+
+enum fuse_readdir_flags {
+    FUSE_READDIR_PLUS = 1
+};
+
+enum fuse_fill_dir_flags {
+    FUSE_FILL_DIR_PLUS = 2
+};
+
+typedef int (*fuse_fill_dir_t)(void* buf, const char* name, const struct stat* st, off_t offset,
+                               enum fuse_fill_dir_flags flags);
+
+struct fuse_operations {
+    int (*getattr)(const char* path, struct stat* st, struct fuse_file_info* fi);
+    int (*readdir)(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+                   struct fuse_file_info* fi, enum fuse_readdir_flags flags);
+    int (*open)(const char* path, struct fuse_file_info* fi);
+    int (*read)(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi);
+    int (*release)(const char* path, struct fuse_file_info* fi);
+    void* (*init)(struct fuse_conn_info* conn, struct fuse_config* cfg);
+    void (*destroy)(void* data);
+};
+
+int fuse_main(int argc, char** argv, const struct fuse_operations* op, void* data);
+
+#endif
@@ -15,282 +15,914 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define ERR_OK          0x00
-#define ERR_USAGE       0x01
-#define ERR_CPRS_FILE   0x02
-#define ERR_UNCPRS      0x04
-#define ERR_OUT_FILE    0x08
+#include "cprs.h"
+#include "uncprs.h"
+
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define STREAM_CHUNK_SIZE   0x10000
+
+static int usage(char* argv0);
+static void* decompress(void* data, size_t sizeBytes, size_t* sizeOut, int stats);
+static void print_stats(const cprs_stats* stats, const cprs_header* header, size_t decodedSize);
+#ifdef HAVE_MMAP
+static int decompress_mapped(void* data, size_t sizeBytes, char* inPath, char* outPath);
+#endif
+static int decompress_stream(char* inPath, char* outPath);
+static int verify_stream(char* inPath, int hashKind, char* expect);
+static int decompress_head(void* data, size_t sizeBytes, char* outPath, size_t head);
+static int decompress_traced(void* data, size_t sizeBytes, char* outPath, char* tracePath);
+static int decompress_inplace(char* inPath, char* outPath);
+static int decompress_indexed(void* data, size_t sizeBytes, char* outPath, char* indexPath, size_t interval);
+static int decompress_range(void* data, size_t sizeBytes, char* outPath, char* indexPath, char* range);
 
-#define FILE_READ_INCREMENT 0x1000
+int main(int argc, char** argv) {
+    int streaming = 0;
+    int inPlace = 0;
+    int speculative = 0;
+    int batch = 0;
+    int scanning = 0;
+    int diffing = 0;
+    int showBytes = 0;
+    int stats = 0;
+    int jobs = 0;
+    char* manifestPath = 0;
+    char* indexPath = 0;
+    size_t indexInterval = 0;
+    char* range = 0;
+    char* tracePath = 0;
+    char* daemonPath = 0;
+    char* connectPath = 0;
+    int verify = 0;
+    int hashKind = HASH_SHA256;
+    char* expect = 0;
+    size_t head = 0;
+    int depth = URING_DEPTH;
+    char* cachePath = 0;
+    uint64_t cacheLimit = CACHE_LIMIT;
+
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-' && argv[argi][1] == '-'; ++argi) {
+        if (strcmp(argv[argi], "--stream") == 0) {
+            streaming = 1;
+        } else if (strcmp(argv[argi], "--in-place") == 0) {
+            inPlace = 1;
+        } else if (strcmp(argv[argi], "--speculative") == 0) {
+            speculative = 1;
+        } else if (strcmp(argv[argi], "--verify") == 0) {
+            verify = 1;
+        } else if (strcmp(argv[argi], "--hash") == 0 && argi + 1 < argc) {
+            hashKind = hash_lookup(argv[++argi]);
+            if (hashKind < 0) {
+                return usage(argv[0]);
+            }
+        } else if (strcmp(argv[argi], "--expect") == 0 && argi + 1 < argc) {
+            expect = argv[++argi];
+        } else if (strcmp(argv[argi], "--batch") == 0) {
+            batch = 1;
+        } else if (strcmp(argv[argi], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[argi], "--diff") == 0) {
+            diffing = 1;
+        } else if (strcmp(argv[argi], "--bytes") == 0) {
+            showBytes = 1;
+        } else if (strcmp(argv[argi], "--scan") == 0) {
+            scanning = 1;
+        } else if (strcmp(argv[argi], "--jobs") == 0 && argi + 1 < argc) {
+            jobs = atoi(argv[++argi]);
+        } else if (strcmp(argv[argi], "--queue-depth") == 0 && argi + 1 < argc) {
+            depth = atoi(argv[++argi]);
+        } else if (strcmp(argv[argi], "--cache") == 0 && argi + 1 < argc) {
+            cachePath = argv[++argi];
+        } else if (strcmp(argv[argi], "--cache-size") == 0 && argi + 1 < argc) {
+            cacheLimit = parse_size(argv[++argi]);
+            if (cacheLimit == 0) {
+                return usage(argv[0]);
+            }
+        } else if (strcmp(argv[argi], "--manifest") == 0 && argi + 1 < argc) {
+            manifestPath = argv[++argi];
+        } else if (strcmp(argv[argi], "--index") == 0 && argi + 1 < argc) {
+            indexPath = argv[++argi];
+        } else if (strcmp(argv[argi], "--index-interval") == 0 && argi + 1 < argc) {
+            indexInterval = strtoull(argv[++argi], 0, 0);
+        } else if (strcmp(argv[argi], "--head") == 0 && argi + 1 < argc) {
+            head = strtoull(argv[++argi], 0, 0);
+            if (head == 0) {
+                return usage(argv[0]);
+            }
+        } else if (strcmp(argv[argi], "--range") == 0 && argi + 1 < argc) {
+            range = argv[++argi];
+        } else if (strcmp(argv[argi], "--trace") == 0 && argi + 1 < argc) {
+            tracePath = argv[++argi];
+        } else if (strcmp(argv[argi], "--daemon") == 0 && argi + 1 < argc) {
+            daemonPath = argv[++argi];
+        } else if (strcmp(argv[argi], "--connect") == 0 && argi + 1 < argc) {
+            connectPath = argv[++argi];
+        } else {
+            return usage(argv[0]);
+        }
+    }
 
-static void* read_file(char* path, size_t* sizeOut);
-static int write_file(char* path, void* data, size_t size);
-static void* decompress(uint32_t* data, size_t sizeBytes, size_t* sizeOut);
+    int positional = argc - argi;
 
-#define CPRS_SIG ((uint32_t)0x53525043)
-#define CPRS_TERM 0x10002
+    if (daemonPath) {
+        if (positional != 0) {
+            return usage(argv[0]);
+        }
+        return daemon_main(daemonPath, jobs);
+    }
 
-#define apply_write_carry(value, byteIndex, carry)  {                          \
-    value &= ~(0xff << (byteIndex * 8));                                       \
-    value |= (carry & 0xff) << (byteIndex * 8);                                \
-}
+    if (diffing) {
+        if (positional != 2) {
+            return usage(argv[0]);
+        }
+        char* pathA = (argv[argi][0] == '-' && argv[argi][1] == 0) ? 0 : argv[argi];
+        char* pathB = (argv[argi + 1][0] == '-' && argv[argi + 1][1] == 0) ? 0 : argv[argi + 1];
+        return diff_main(pathA, pathB, showBytes);
+    }
 
-static const uint32_t CPRS_TABLE[192];
+    if (scanning) {
+        if (positional != 2 || batch || manifestPath) {
+            return usage(argv[0]);
+        }
+        char* imagePath = (argv[argi][0] == '-' && argv[argi][1] == 0) ? 0 : argv[argi];
+        return scan_main(imagePath, argv[argi + 1], jobs, head);
+    }
 
-int main(int argc, char** argv) {
-    if (argc != 2 && argc != 3) {
-        fprintf(stderr, "Usage: %s INPUTFILE [OUTPUTFILE]\n", argv[0]);
-        return ERR_USAGE;
+    if (batch) {
+        if (manifestPath ? positional != 0 : (positional == 0 || positional % 2 != 0)) {
+            return usage(argv[0]);
+        }
+        cache* c = 0;
+        if (cachePath && !(c = cache_open(cachePath, cacheLimit))) {
+            return ERR_USAGE;
+        }
+        int result = batch_main(argv + argi, positional / 2, manifestPath, jobs, depth, c);
+        cache_close(c);
+        return result;
+    }
+
+    if ((positional != 1 && positional != 2) || manifestPath) {
+        return usage(argv[0]);
+    }
+
+    char* inPath = (argv[argi][0] == '-' && argv[argi][1] == 0) ? 0 : argv[argi];
+    char* outPath = positional == 2 ? argv[argi + 1] : 0;
+
+    if (connectPath) {
+        return client_main(connectPath, inPath, outPath);
+    }
+
+    if (verify) {
+        if (positional != 1) {
+            return usage(argv[0]);
+        }
+        return verify_stream(inPath, hashKind, expect);
+    }
+
+    if (cachePath) {
+        if (streaming || stats || head || range || indexPath || tracePath) {
+            return usage(argv[0]);
+        }
+        cache* c = cache_open(cachePath, cacheLimit);
+        if (!c) {
+            return ERR_USAGE;
+        }
+        scratch_buffer scratch = { 0, 0 };
+        int result = decompress_file(inPath, outPath, &scratch, c);
+        free(scratch.data);
+        cache_close(c);
+        return result;
+    }
+
+    if (streaming) {
+        return decompress_stream(inPath, outPath);
+    }
+
+    if (inPlace) {
+        return decompress_inplace(inPath, outPath);
     }
 
     size_t compressedSize = 0;
-    void* compressed = read_file(
-            (argv[1][0] == '-' && argv[1][1] == 0) ? 0 : argv[1],
-            &compressedSize);
+    int mapped = 0;
+    void* compressed = read_file(inPath, &compressedSize, &mapped);
 
     if (!compressed) {
         return ERR_CPRS_FILE;
     }
 
+    /*  These work on a single blob; given a multi-member file they would
+        quietly produce its first member only. */
+    if (head || tracePath || range || indexPath || stats) {
+        member* members;
+        size_t count = members_split(compressed, compressedSize, &members);
+        if (count) {
+            fprintf(stderr, "Error: %s holds %zu members; --head, --trace, --index, --range and "
+                    "--stats take a single blob\n", inPath ? inPath : "-", count);
+            free(members);
+            free_file(compressed, compressedSize, mapped);
+            return ERR_UNCPRS;
+        }
+    }
+
+    if (head) {
+        int result = decompress_head(compressed, compressedSize, outPath, head);
+        free_file(compressed, compressedSize, mapped);
+        return result;
+    }
+
+    if (tracePath) {
+        int result = decompress_traced(compressed, compressedSize, outPath, tracePath);
+        free_file(compressed, compressedSize, mapped);
+        return result;
+    }
+
+    if (range || indexPath) {
+        int result = range
+            ? decompress_range(compressed, compressedSize, outPath, indexPath, range)
+            : decompress_indexed(compressed, compressedSize, outPath, indexPath, indexInterval);
+        free_file(compressed, compressedSize, mapped);
+        return result;
+    }
+
+    if (!stats) {
+        member* members;
+        size_t count = members_split(compressed, compressedSize, &members);
+        if (count) {
+            int result = members_main(compressed, members, count, outPath, jobs);
+            free(members);
+            free_file(compressed, compressedSize, mapped);
+            return result;
+        }
+    }
+
+    /*  Multi-member files are already decoded in parallel above. */
+    if (speculative) {
+        int result = speculative_main(compressed, compressedSize, outPath, jobs);
+        free_file(compressed, compressedSize, mapped);
+        return result;
+    }
+
+#ifdef HAVE_MMAP
+    if (outPath && !stats) {
+        int result = decompress_mapped(compressed, compressedSize, inPath, outPath);
+        if (result >= 0) {
+            free_file(compressed, compressedSize, mapped);
+            return result;
+        }
+    }
+#endif
+
     size_t decompressedSize = 0;
-    void* decompressed = decompress(compressed, compressedSize, &decompressedSize);
+    void* decompressed = decompress(compressed, compressedSize, &decompressedSize, stats);
 
-    free(compressed);
+    free_file(compressed, compressedSize, mapped);
     compressed = 0;
 
     if (!decompressed) {
         return ERR_UNCPRS;
     }
 
-    int success = write_file(
-            argc == 3 ? argv[2] : 0,
-            decompressed,
-            decompressedSize);
+    int success = write_file(outPath, decompressed, decompressedSize);
 
     free(decompressed);
 
     return success ? ERR_OK : ERR_OUT_FILE;
 }
 
-static void* read_file(char* path, size_t* sizeOut) {
-    FILE* file = path ? fopen(path, "rb") : stdin;
-    if (!file) {
-        fprintf(stderr, "Error: Unable to open file %s\n", path);
+static int usage(char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [--stream | --stats | --in-place] INPUTFILE [OUTPUTFILE]\n"
+            "       %s --speculative [--jobs N] INPUTFILE [OUTPUTFILE]\n"
+            "       %s --cache DIR [--cache-size BYTES] INPUTFILE [OUTPUTFILE]\n"
+            "       %s --batch [--jobs N] [--queue-depth N] [--cache DIR] INPUTFILE OUTPUTFILE [INPUTFILE OUTPUTFILE ...]\n"
+            "       %s --batch [--jobs N] [--queue-depth N] [--cache DIR] --manifest LISTFILE\n"
+            "       %s --scan [--jobs N] [--head N] IMAGEFILE OUTPUTPREFIX\n"
+            "       %s --head N INPUTFILE [OUTPUTFILE]\n"
+            "       %s --trace TRACEFILE INPUTFILE [OUTPUTFILE]\n"
+            "       %s --index INDEXFILE [--index-interval N] INPUTFILE [OUTPUTFILE]\n"
+            "       %s --range OFFSET:LEN [--index INDEXFILE] INPUTFILE [OUTPUTFILE]\n"
+            "       %s --verify [--hash sha256|crc32|xxh64] [--expect DIGEST] INPUTFILE\n"
+            "       %s --diff [--bytes] INPUTFILE INPUTFILE\n"
+            "       %s --daemon SOCKET [--jobs N]\n"
+            "       %s --connect SOCKET INPUTFILE [OUTPUTFILE]\n",
+            argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+    return ERR_USAGE;
+}
+
+/*  With `stats`, decodes through cprs_decode_stats() and reports the
+    counters on stderr. */
+static void* decompress(void* data, size_t sizeBytes, size_t* sizeOut, int stats) {
+    cprs_header header;
+    int status = cprs_header_peek(data, sizeBytes, &header);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        return 0;
+    }
+
+    void* buffer = malloc(header.decompressedSize ? header.decompressedSize : 1);
+    if (!buffer) {
+        fprintf(stderr, "Error: Unable to allocate %u bytes\n", header.decompressedSize);
+        return 0;
+    }
+
+    cprs_stats counters;
+    status = stats
+        ? cprs_decode_stats(data, sizeBytes, buffer, header.decompressedSize, sizeOut, &counters)
+        : cprs_decode(data, sizeBytes, buffer, header.decompressedSize, sizeOut);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        free(buffer);
         return 0;
     }
 
-    uint8_t* buffer = 0;
-    size_t bufferSize = 0;
-    size_t totalBytesRead = 0;
+    if (stats) {
+        print_stats(&counters, &header, *sizeOut);
+    }
+    return buffer;
+}
 
-    size_t bytesRead = 0;
-    do {
-        totalBytesRead += bytesRead;
+static void print_histogram(const char* name, const uint64_t* buckets) {
+    int last = CPRS_STATS_BUCKETS - 1;
+    while (last > 0 && buckets[last] == 0) {
+        --last;
+    }
+    fprintf(stderr, "%s:\n", name);
+    for (int i = 1; i <= last; ++i) {
+        fprintf(stderr, "  %6lu-%-6lu %12llu\n", 1UL << i, (2UL << i) - 1, (unsigned long long)buckets[i]);
+    }
+}
 
-        if (totalBytesRead >= bufferSize) {
-            buffer = realloc(buffer, bufferSize + FILE_READ_INCREMENT);
-            bufferSize += FILE_READ_INCREMENT;
+static void print_stats(const cprs_stats* stats, const cprs_header* header, size_t decodedSize) {
+    uint64_t tokens = stats->literalTokens + stats->runTokens + stats->matchTokens;
+    fprintf(stderr, "tokens      %12llu\n", (unsigned long long)tokens);
+    fprintf(stderr, "  literal   %12llu\n", (unsigned long long)stats->literalTokens);
+    fprintf(stderr, "  run       %12llu  %12llu bytes\n",
+            (unsigned long long)stats->runTokens, (unsigned long long)stats->runBytes);
+    fprintf(stderr, "  match     %12llu  %12llu bytes\n",
+            (unsigned long long)stats->matchTokens, (unsigned long long)stats->matchBytes);
+    fprintf(stderr, "refills     %12llu\n", (unsigned long long)stats->refills);
+    fprintf(stderr, "compressed  %12u\n", header->compressedSize);
+    fprintf(stderr, "decoded     %12zu\n", decodedSize);
+    fprintf(stderr, "ratio       %12.4f\n", decodedSize ? (double)header->compressedSize / decodedSize : 0.0);
+    print_histogram("match lengths", stats->lengths);
+    print_histogram("match distances", stats->distances);
+}
+
+int decompress_file(char* inPath, char* outPath, scratch_buffer* scratch, cache* c) {
+    size_t compressedSize = 0;
+    int mapped = 0;
+    void* compressed = read_file(inPath, &compressedSize, &mapped);
+    if (!compressed) {
+        return ERR_CPRS_FILE;
+    }
+
+    uint64_t key = 0;
+    if (c) {
+        key = cache_key(compressed, compressedSize);
+        int result = cache_get(c, key, compressed, compressedSize, outPath);
+        if (result >= 0) {
+            free_file(compressed, compressedSize, mapped);
+            return result;
         }
-    } while ((bytesRead = fread(buffer + totalBytesRead, 1, bufferSize - totalBytesRead, file)) != 0);
+    }
 
-    if (path) {
-        fclose(file);
+    size_t decompressedSize = 0;
+    int result = decompress_buffer(compressed, compressedSize, inPath, scratch, &decompressedSize);
+
+    if (result == ERR_OK && c) {
+        result = cache_put(c, key, compressed, compressedSize, scratch->data, decompressedSize, outPath);
+    } else if (result == ERR_OK) {
+        result = write_file(outPath, scratch->data, decompressedSize) ? ERR_OK : ERR_OUT_FILE;
     }
+    free_file(compressed, compressedSize, mapped);
+    return result;
+}
 
-    *sizeOut = totalBytesRead;
-    return buffer;
+int decompress_buffer(const uint8_t* data, size_t size, char* name, scratch_buffer* scratch, size_t* outLen) {
+    size_t total = decompress_size(data, size);
+    uint8_t* buffer = scratch_reserve(scratch, total);
+    if (!buffer) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", total);
+        return ERR_UNCPRS;
+    }
+    return decompress_into(data, size, name, buffer, outLen);
 }
 
-static int write_file(char* path, void* data, size_t size) {
-    FILE* file = path ? fopen(path, "wb") : stdout;
-    if (!file) {
-        fprintf(stderr, "Error: Unable to open file %s for writing\n", path);
-        return 0;
+size_t decompress_size(const uint8_t* data, size_t size) {
+    member* members;
+    size_t count = members_split(data, size, &members);
+    if (count) {
+        size_t total = members[count - 1].outOffset + members[count - 1].header.decompressedSize;
+        free(members);
+        return total;
     }
 
-    size_t written = fwrite(data, 1, size, file);
-    if (written != size) {
-        fprintf(stderr, "Error: Failed to write all data to file %s\n", path);
-        fclose(file);
-        return 0;
+    cprs_header header;
+    return cprs_header_peek(data, size, &header) == CPRS_OK ? header.decompressedSize : 0;
+}
+
+int decompress_into(const uint8_t* data, size_t size, char* name, uint8_t* out, size_t* outLen) {
+    member* members;
+    size_t count = members_split(data, size, &members);
+    if (count) {
+        /*  Already on a pool worker, so the members go one after another. */
+        size_t decoded = members_decode(data, members, count, out, 1);
+        free(members);
+        if (decoded == (size_t)-1) {
+            return ERR_UNCPRS;
+        }
+        *outLen = decoded;
+        return ERR_OK;
     }
 
-    if (path) {
-        fclose(file);
+    cprs_header header;
+    int status = cprs_header_peek(data, size, &header);
+    if (status == CPRS_OK) {
+        status = cprs_decode(data, size, out, header.decompressedSize, outLen);
     }
-    return 1;
+
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s: %s\n", name ? name : "-", cprs_strerror(status));
+        return ERR_UNCPRS;
+    }
+    return ERR_OK;
 }
 
-static void* decompress(uint32_t* data, size_t sizeBytes, size_t* sizeOut) {
-    if (sizeBytes % 4 != 0) {
-        fprintf(stderr, "Error: Source buffer not 4-byte aligned\n");
-        return 0;
+#ifdef HAVE_MMAP
+/*  Decodes straight into the pages of the output file, which is opened in
+    place like fopen() would (through a symlink, sharing its inode with any
+    hard links) and allocated up front to the header's decompressedSize, so
+    running out of space is an error here rather than SIGBUS in the decode.
+    It is cut to the decoded length afterwards. A failed decode removes an
+    output this created and empties one that was there. Returns -1 when
+    the output can't be handled like that (not a regular file, the input
+    itself, no read access, ...) so the caller can fall back to writing it
+    out normally. */
+static int decompress_mapped(void* data, size_t sizeBytes, char* inPath, char* outPath) {
+    cprs_header header;
+    if (cprs_header_peek(data, sizeBytes, &header) != CPRS_OK || header.decompressedSize == 0) {
+        return -1;
     }
 
-    if (sizeBytes <= 20) {
-        fprintf(stderr, "Error: Source buffer too small\n");
-        return 0;
+    struct stat st;
+    struct stat inSt;
+    int exists = stat(outPath, &st) == 0;
+    if ((exists && !S_ISREG(st.st_mode))
+            || (exists && inPath && stat(inPath, &inSt) == 0
+                && st.st_dev == inSt.st_dev && st.st_ino == inSt.st_ino)) {
+        return -1;
     }
 
-    if (data[0] != CPRS_SIG || data[(sizeBytes / 4) - 1] != CPRS_SIG) {
-        fprintf(stderr, "Error: CPRS signature check failed\n");
-        return 0;
+    int fd = open(outPath, O_RDWR | O_CREAT, 0666);
+    if (fd < 0) {
+        return -1;
+    }
+
+    void* out = MAP_FAILED;
+    if (ftruncate(fd, 0) == 0 && posix_fallocate(fd, 0, header.decompressedSize) == 0) {
+        out = mmap(0, header.decompressedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (out == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    size_t decodedSize = 0;
+    int status = cprs_decode(data, sizeBytes, out, header.decompressedSize, &decodedSize);
+    munmap(out, header.decompressedSize);
+
+    int result = ERR_OK;
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        result = ERR_UNCPRS;
+        decodedSize = 0;
+    }
+    if (decodedSize != header.decompressedSize && ftruncate(fd, decodedSize) != 0 && result == ERR_OK) {
+        result = ERR_OUT_FILE;
+    }
+    if (close(fd) != 0 && result == ERR_OK) {
+        result = ERR_OUT_FILE;
+    }
+    if (result == ERR_OUT_FILE) {
+        fprintf(stderr, "Error: Failed to write all data to file %s\n", outPath);
+    }
+    if (result != ERR_OK && !exists) {
+        unlink(outPath);
+    }
+    return result;
+}
+#endif
+
+/*  Pushes `in` through a member_stream chunk by chunk, writing the output
+    to `out` and/or feeding it to `hash` as it comes out of the window, so
+    neither the compressed nor the decompressed image is ever held in
+    memory. `sizes` (if non-null) gets the members' compressedSize and
+    decompressedSize totals and the number of bytes they produced. */
+static int stream_decode(FILE* in, FILE* out, char* outPath, hash_state* hash, uint64_t* sizes) {
+    member_stream stream;
+    int opened = member_stream_open(&stream);
+    uint8_t* inChunk = malloc(STREAM_CHUNK_SIZE);
+    uint8_t* outChunk = malloc(STREAM_CHUNK_SIZE);
+
+    int result = ERR_OK;
+    int status = CPRS_OK;
+    uint64_t total = 0;
+
+    if (!opened || !inChunk || !outChunk) {
+        fprintf(stderr, "Error: Unable to allocate stream buffers\n");
+        result = ERR_UNCPRS;
+        status = CPRS_STREAM_END;
+    }
+
+    size_t bytesRead;
+    while (status != CPRS_STREAM_END
+            && (bytesRead = fread(inChunk, 1, STREAM_CHUNK_SIZE, in)) != 0) {
+        size_t offset = 0;
+        do {
+            size_t used;
+            status = member_stream_push(&stream, inChunk + offset, bytesRead - offset, &used);
+            offset += used;
+
+            size_t pulled;
+            while ((pulled = member_stream_pull(&stream, outChunk, STREAM_CHUNK_SIZE)) != 0) {
+                total += pulled;
+                if (hash) {
+                    hash_update(hash, outChunk, pulled);
+                }
+                if (out && fwrite(outChunk, 1, pulled, out) != pulled) {
+                    fprintf(stderr, "Error: Failed to write all data to file %s\n", outPath);
+                    result = ERR_OUT_FILE;
+                    status = CPRS_STREAM_END;
+                    break;
+                }
+            }
+        } while (status == CPRS_STREAM_FULL);
+
+        if (status < 0) {
+            break;
+        }
     }
 
-    uint32_t compressedSize = data[1];
-    uint32_t decompressedSize = data[2];
+    if (result == ERR_OK && status == CPRS_OK) {
+        status = member_stream_finish(&stream);
+    }
+    if (result == ERR_OK && status != CPRS_STREAM_END) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status < 0 ? status : CPRS_E_TRUNC));
+        result = ERR_UNCPRS;
+    }
 
-    uint32_t* buffer = malloc(decompressedSize);
-    memset(buffer, 0, decompressedSize);
+    if (sizes) {
+        sizes[0] = stream.compressedSize;
+        sizes[1] = stream.decompressedSize;
+        sizes[2] = total;
+    }
 
-    uint32_t alpha = data[3];
-    uint32_t beta = data[4];
+    free(outChunk);
+    free(inChunk);
+    member_stream_close(&stream);
+    return result;
+}
 
-    int8_t remainingShifts = 0x20;
-    uint32_t currentValue = 0;
+static int decompress_stream(char* inPath, char* outPath) {
+    FILE* in = inPath ? fopen(inPath, "rb") : stdin;
+    if (!in) {
+        fprintf(stderr, "Error: Unable to open file %s\n", inPath);
+        return ERR_CPRS_FILE;
+    }
 
-    uint32_t readIndex = 5;
-    uint32_t writeIndex = 0;
+    FILE* out = outPath ? fopen(outPath, "wb") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: Unable to open file %s for writing\n", outPath);
+        if (inPath) {
+            fclose(in);
+        }
+        return ERR_OUT_FILE;
+    }
 
-    uint32_t extractedBytes = 0;
+    int result = stream_decode(in, out, outPath, 0, 0);
 
-    /*  I don't fully understand this and don't really need to.
+    if (outPath && fclose(out) != 0 && result == ERR_OK) {
+        fprintf(stderr, "Error: Failed to write all data to file %s\n", outPath);
+        result = ERR_OUT_FILE;
+    }
+    if (inPath) {
+        fclose(in);
+    }
+    return result;
+}
 
-        It's just a tidied up decompilation of the decompression
-        function found in the internal flash of a Seagate/LSI MCU.
+/*  Decodes through the stream window into a digest only, and prints
+    "STATUS<TAB>COMPRESSED<TAB>DECOMPRESSED<TAB>EXTRACTED<TAB>HASH:DIGEST<TAB>INPUT".
+    The sizes are totals over the members of a multi-member file. Fails if
+    the stream is corrupt, if it produced a different number of bytes than
+    the headers' decompressedSize, or if `expect` is given and
+    the digest differs from it. */
+static int verify_stream(char* inPath, int hashKind, char* expect) {
+    FILE* in = inPath ? fopen(inPath, "rb") : stdin;
+    if (!in) {
+        fprintf(stderr, "Error: Unable to open file %s\n", inPath);
+        return ERR_CPRS_FILE;
+    }
 
-        It's definitely not safe currently, there's absolutely no
-        bounds checking.
-     */
+    hash_state hash;
+    hash_init(&hash, hashKind);
 
-    uint8_t writeCarryByte;
+    uint64_t sizes[3];
+    int result = stream_decode(in, 0, 0, &hash, sizes);
 
-    while (1) {
-        uint32_t readCarry;
+    char digest[HASH_HEX_SIZE];
+    hash_final(&hash, digest);
 
-        if ((alpha & 1) == 0) {
-            readCarry = alpha >> 9;
-            remainingShifts -= 9;
-            writeCarryByte = alpha >> 1 & 0xff;
-            alpha = extractedBytes & 3;
-            extractedBytes += 1;
-            apply_write_carry(currentValue, alpha, writeCarryByte);
-            if ((extractedBytes & 3) == 0) {
-                buffer[writeIndex++] = currentValue;
-                currentValue = 0;
-            }
-        } else {
-            uint32_t uVar9 = CPRS_TABLE[(alpha >> 1 & 3) * 0x04];
-            uint32_t uVar1 = (alpha >> 3) >> (uVar9 & 0xff);
-            uint32_t uVar5 = uVar1 >> 4;
-            size_t tableIndex = (uVar1 & 0xf) * 0x04 + 0x10;
-            uVar1 = CPRS_TABLE[tableIndex];
-            readCarry = uVar5 >> (uVar1 & 0xff);
-            remainingShifts -= uVar9 + 7 + uVar1;
-            int iVar7 = CPRS_TABLE[tableIndex + 2] + ((1 << (uVar1 & 0xff)) - 1U & uVar5);
-            if (iVar7 >= CPRS_TERM) {
-                break;
-            }
-            int iVar6 = CPRS_TABLE[(alpha >> 1 & 3) * 0x04 + 2]
-                + ((1 << (uVar9 & 0xff)) - 1U & alpha >> 3)
-                + ((int)(CPRS_TABLE[tableIndex + 1] + 0xb) >> 3);
-            if (iVar7 == 0) {
-                while (iVar6--) {
-                    alpha = extractedBytes & 3;
-                    extractedBytes += 1;
-                    apply_write_carry(currentValue, alpha, writeCarryByte);
-                    if ((extractedBytes & 3) == 0) {
-                        buffer[writeIndex++] = currentValue;
-                        currentValue = 0;
-                    }
-                }
-            } else {
-                int startIndex = extractedBytes - iVar7 * 2;
-                for (int i = startIndex; i < startIndex + iVar6; ++i) {
-                    if (iVar7 * 2 < 4 && (extractedBytes & 3) != 0) {
-                        buffer[writeIndex] = currentValue;
-                    }
-                    writeCarryByte = ((uint8_t*)buffer)[i];
-                    alpha = extractedBytes & 3;
-                    extractedBytes += 1;
-                    apply_write_carry(currentValue, alpha, writeCarryByte);
-                    if ((extractedBytes & 3) == 0) {
-                        buffer[writeIndex++] = currentValue;
-                        currentValue = 0;
-                    }
-                }
-            }
+    if (inPath) {
+        fclose(in);
+    }
+
+    if (result == ERR_OK && sizes[2] != sizes[1]) {
+        fprintf(stderr, "Error: Extracted %llu bytes, headers say %llu\n",
+                (unsigned long long)sizes[2], (unsigned long long)sizes[1]);
+        result = ERR_UNCPRS;
+    }
+    if (result == ERR_OK && expect && strcmp(expect, digest) != 0) {
+        fprintf(stderr, "Error: %s digest %s does not match %s\n", hash_name(hashKind), digest, expect);
+        result = ERR_UNCPRS;
+    }
+
+    printf("%d\t%llu\t%llu\t%llu\t%s:%s\t%s\n", result, (unsigned long long)sizes[0],
+           (unsigned long long)sizes[1], (unsigned long long)sizes[2], hash_name(hashKind), digest,
+           inPath ? inPath : "-");
+    return result;
+}
+
+/*  Reads the blob into the end of a single cprs_inplace_size() buffer and
+    decodes it into the start of that same buffer, so the input costs only
+    the margin on top of the output. Trailing bytes after compressedSize
+    are ignored, but another member there is refused, as this mode has
+    room for one. */
+static int decompress_inplace(char* inPath, char* outPath) {
+    FILE* in = inPath ? fopen(inPath, "rb") : stdin;
+    if (!in) {
+        fprintf(stderr, "Error: Unable to open file %s\n", inPath);
+        return ERR_CPRS_FILE;
+    }
+
+    uint8_t start[12];
+    if (fread(start, 1, sizeof(start), in) != sizeof(start)) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(CPRS_E_SMALL));
+        if (inPath) {
+            fclose(in);
         }
+        return ERR_UNCPRS;
+    }
 
-        if (remainingShifts < 0) {
-            remainingShifts += 0x20;
-            readCarry = beta >> (0x20 - remainingShifts);
-            beta = data[readIndex++];
+    cprs_header header;
+    header.compressedSize = start[4] | start[5] << 8 | start[6] << 16 | (uint32_t)start[7] << 24;
+    header.decompressedSize = start[8] | start[9] << 8 | start[10] << 16 | (uint32_t)start[11] << 24;
+    if (header.compressedSize < sizeof(start)) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(CPRS_E_SMALL));
+        if (inPath) {
+            fclose(in);
         }
-        alpha = (beta << remainingShifts) | readCarry;
+        return ERR_UNCPRS;
     }
 
-    if ((extractedBytes & 3) != 0) {
-        buffer[writeIndex] = currentValue;
+    size_t size = cprs_inplace_size(&header);
+    uint8_t* buffer = malloc(size);
+    if (!buffer) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", size);
+        if (inPath) {
+            fclose(in);
+        }
+        return ERR_UNCPRS;
     }
-    if (sizeOut) {
-        *sizeOut = extractedBytes;
+
+    uint8_t* blob = buffer + size - header.compressedSize;
+    memcpy(blob, start, sizeof(start));
+    size_t rest = header.compressedSize - sizeof(start);
+    size_t got = fread(blob + sizeof(start), 1, rest, in);
+    uint8_t next[4];
+    size_t nextLen = got == rest ? fread(next, 1, sizeof(next), in) : 0;
+    if (inPath) {
+        fclose(in);
     }
-    return buffer;
+    if (got != rest) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(CPRS_E_TRUNC));
+        free(buffer);
+        return ERR_UNCPRS;
+    }
+    if (nextLen == sizeof(next) && memcmp(next, "CPRS", sizeof(next)) == 0) {
+        fprintf(stderr, "Error: %s holds more than one member; --in-place takes a single blob\n",
+                inPath ? inPath : "-");
+        free(buffer);
+        return ERR_UNCPRS;
+    }
+
+    size_t decoded = 0;
+    int status = cprs_decode_inplace(buffer, size, header.compressedSize, &decoded);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        free(buffer);
+        return ERR_UNCPRS;
+    }
+
+    int success = write_file(outPath, buffer, decoded);
+    free(buffer);
+    return success ? ERR_OK : ERR_OUT_FILE;
+}
+
+/*  Decodes just the first `head` bytes, allocating no more than that. */
+static int decompress_head(void* data, size_t sizeBytes, char* outPath, size_t head) {
+    cprs_header header;
+    int status = cprs_header_peek(data, sizeBytes, &header);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        return ERR_UNCPRS;
+    }
+
+    if (head > header.decompressedSize) {
+        head = header.decompressedSize;
+    }
+
+    uint8_t* buffer = malloc(head ? head : 1);
+    if (!buffer) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", head);
+        return ERR_UNCPRS;
+    }
+
+    size_t decoded = 0;
+    status = cprs_decode_head(data, sizeBytes, buffer, head, &decoded);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        free(buffer);
+        return ERR_UNCPRS;
+    }
+
+    int success = write_file(outPath, buffer, decoded);
+    free(buffer);
+    return success ? ERR_OK : ERR_OUT_FILE;
+}
+
+/*  A trace file is a TRACE_HEADER_SIZE header (signature, record size,
+    compressedSize and decompressedSize, 32-bit little-endian each) and
+    then the records of cprs_decode_trace() as they come. cprstrace.py
+    reads them. */
+#define TRACE_SIG           ((uint32_t)0x54525043)
+#define TRACE_HEADER_SIZE   16
+#define TRACE_BUFFER_SIZE   0x100000
+
+static int trace_sink(void* context, const void* records, size_t count) {
+    return fwrite(records, CPRS_TRACE_RECORD_SIZE, count, context) != count;
+}
+
+static void put32le(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/*  Normal decode that also writes the token trace. A failed decode still
+    leaves the trace up to the token that failed it. */
+static int decompress_traced(void* data, size_t sizeBytes, char* outPath, char* tracePath) {
+    cprs_header header;
+    int status = cprs_header_peek(data, sizeBytes, &header);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        return ERR_UNCPRS;
+    }
+
+    FILE* trace = fopen(tracePath, "wb");
+    if (!trace) {
+        fprintf(stderr, "Error: Unable to open file %s for writing\n", tracePath);
+        return ERR_OUT_FILE;
+    }
+    setvbuf(trace, 0, _IOFBF, TRACE_BUFFER_SIZE);
+
+    uint8_t* buffer = malloc(header.decompressedSize ? header.decompressedSize : 1);
+    if (!buffer) {
+        fprintf(stderr, "Error: Unable to allocate %u bytes\n", header.decompressedSize);
+        fclose(trace);
+        return ERR_UNCPRS;
+    }
+
+    uint8_t traceHeader[TRACE_HEADER_SIZE];
+    put32le(traceHeader, TRACE_SIG);
+    put32le(traceHeader + 4, CPRS_TRACE_RECORD_SIZE);
+    put32le(traceHeader + 8, header.compressedSize);
+    put32le(traceHeader + 12, header.decompressedSize);
+
+    size_t decoded = 0;
+    status = fwrite(traceHeader, sizeof(traceHeader), 1, trace) == 1
+        ? cprs_decode_trace(data, sizeBytes, buffer, header.decompressedSize, &decoded, trace_sink, trace)
+        : CPRS_E_TRACE;
+    int traced = fclose(trace) == 0 && status != CPRS_E_TRACE;
+
+    int result = ERR_OK;
+    if (!traced) {
+        fprintf(stderr, "Error: Failed to write all data to file %s\n", tracePath);
+        result = ERR_OUT_FILE;
+    } else if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        result = ERR_UNCPRS;
+    } else if (!write_file(outPath, buffer, decoded)) {
+        result = ERR_OUT_FILE;
+    }
+
+    free(buffer);
+    return result;
 }
 
-static const uint32_t CPRS_TABLE[192] = {
-    0x00000001, 0x00000003, 0x00000000, 0x00000001,
-    0x00000001, 0x00000003, 0x00000002, 0x00000003,
-    0x00000003, 0x00000005, 0x00000004, 0x0000000b,
-    0x00000008, 0x0000000a, 0x0000000c, 0x0000010a,
-    0x00000002, 0x00000006, 0x00000000, 0x00000003,
-    0x00000002, 0x00000006, 0x00000004, 0x00000007,
-    0x00000002, 0x00000006, 0x00000008, 0x0000000b,
-    0x00000003, 0x00000007, 0x0000000c, 0x00000013,
-    0x00000004, 0x00000008, 0x00000014, 0x00000023,
-    0x00000005, 0x00000009, 0x00000024, 0x00000043,
-    0x00000006, 0x0000000a, 0x00000044, 0x00000083,
-    0x00000007, 0x0000000b, 0x00000084, 0x00000103,
-    0x00000008, 0x0000000c, 0x00000104, 0x00000203,
-    0x00000009, 0x0000000d, 0x00000204, 0x00000403,
-    0x0000000a, 0x0000000e, 0x00000404, 0x00000803,
-    0x0000000b, 0x0000000f, 0x00000804, 0x00001003,
-    0x0000000c, 0x00000010, 0x00001004, 0x00002003,
-    0x0000000d, 0x00000011, 0x00002004, 0x00004003,
-    0x0000000e, 0x00000012, 0x00004004, 0x00008003,
-    0x0000000f, 0x00000013, 0x00008004, 0x00010002,
-    0x00000001, 0x00000002, 0x00000004, 0x00000008,
-    0x00000010, 0x00000020, 0x00000040, 0x00000080,
-    0x00000100, 0x00000200, 0x00000400, 0x00000800,
-    0x00001000, 0x00002000, 0x00004000, 0x00008000,
-    0x00010000, 0x00020000, 0x00040000, 0x00080000,
-    0x00000009, 0x00000012, 0x00000024, 0x00000048,
-    0x00000090, 0x00000120, 0x00000240, 0x00000480,
-    0x00000900, 0x00001200, 0x00002400, 0x00004800,
-    0x00000001, 0x00009000, 0x00002490, 0x00010900,
-    0x00004349, 0x00000091, 0x00019024, 0x00002599,
-    0x00051941, 0x0005d34b, 0x00004101, 0x00008001,
-    0x0000b080, 0x00082c94, 0x00014308, 0x0004d183,
-    0x000880b5, 0x0003f8ad, 0x000cadd5, 0x0004f7db,
-    0x00010901, 0x0000d349, 0x00002401, 0x00009924,
-    0x000066d0, 0x000519d0, 0x0004436f, 0x00006498,
-    0x00059940, 0x000563cb, 0x00086d95, 0x0001c309,
-    0x00000000, 0x00c602b5, 0x018c016b, 0x01ce037b,
-    0x02940021, 0x01290042, 0x01ad0231, 0x02520084,
-    0x031802d6, 0x0210014a, 0x039c02f7, 0x027303de,
-    0x03bd00e7, 0x035a0063, 0x01ef0339, 0x00a50108,
-    0x015502aa, 0x0372025b, 0x00b702e5, 0x00100200,
-    0x01f602cf, 0x019f03ec, 0x039602dc, 0x03d9033e,
-    0x01cb016e, 0x00fb0367, 0x00010020, 0x00040080,
-    0x00080100, 0x01b9032d, 0x00020040, 0x027d03b3,
-    0x021d0160, 0x03b0000b, 0x00240111, 0x00810228,
-    0x0335019b, 0x02b9036c, 0x02d500b6, 0x02b602c5,
-    0x01e30185, 0x006f00ac, 0x03b502a2, 0x02bd0055,
-    0x02690192, 0x0133024c, 0x02f501f4, 0x02b7028f
-};
+/*  Normal decode that also writes a checkpoint index for --range. */
+static int decompress_indexed(void* data, size_t sizeBytes, char* outPath, char* indexPath, size_t interval) {
+    cprs_header header;
+    int status = cprs_header_peek(data, sizeBytes, &header);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        return ERR_UNCPRS;
+    }
+
+    size_t indexCap = cprs_index_bound(header.decompressedSize, interval);
+    void* buffer = malloc(header.decompressedSize ? header.decompressedSize : 1);
+    void* index = malloc(indexCap);
+    if (!buffer || !index) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", header.decompressedSize + indexCap);
+        free(buffer);
+        free(index);
+        return ERR_UNCPRS;
+    }
+
+    size_t decompressedSize = 0;
+    size_t indexSize = 0;
+    status = cprs_decode_indexed(data, sizeBytes, buffer, header.decompressedSize, &decompressedSize,
+                                 interval, index, indexCap, &indexSize);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        free(buffer);
+        free(index);
+        return ERR_UNCPRS;
+    }
+
+    int result = write_file(outPath, buffer, decompressedSize) ? ERR_OK : ERR_OUT_FILE;
+    if (!write_file(indexPath, index, indexSize)) {
+        result |= ERR_OUT_FILE;
+    }
+
+    free(buffer);
+    free(index);
+    return result;
+}
+
+/*  Decodes only OFFSET:LEN of the output, through the index if given. */
+static int decompress_range(void* data, size_t sizeBytes, char* outPath, char* indexPath, char* range) {
+    char* end;
+    size_t offset = strtoull(range, &end, 0);
+    if (end == range || *end != ':') {
+        fprintf(stderr, "Error: Range must be OFFSET:LEN, not %s\n", range);
+        return ERR_USAGE;
+    }
+    char* lengthText = end + 1;
+    size_t length = strtoull(lengthText, &end, 0);
+    if (end == lengthText || *end != 0) {
+        fprintf(stderr, "Error: Range must be OFFSET:LEN, not %s\n", range);
+        return ERR_USAGE;
+    }
+
+    size_t indexSize = 0;
+    int indexMapped = 0;
+    void* index = 0;
+    if (indexPath && !(index = read_file(indexPath, &indexSize, &indexMapped))) {
+        return ERR_CPRS_FILE;
+    }
+
+    int result = ERR_OK;
+    void* buffer = malloc(length ? length : 1);
+    size_t produced = 0;
+    int status = buffer
+        ? cprs_decode_range(data, sizeBytes, index, indexSize, offset, buffer, length, &produced)
+        : CPRS_E_NOMEM;
+
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        result = ERR_UNCPRS;
+    } else if (!write_file(outPath, buffer, produced)) {
+        result = ERR_OUT_FILE;
+    }
+
+    free(buffer);
+    if (index) {
+        free_file(index, indexSize, indexMapped);
+    }
+    return result;
+}
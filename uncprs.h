@@ -0,0 +1,237 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNCPRS_H
+#define UNCPRS_H
+
+/*  Pieces of the uncprs tool shared between its source files. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cprs.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP 1
+#define HAVE_THREADS 1
+#define HAVE_CACHE 1
+#define HAVE_DAEMON 1
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_URING 1
+#endif
+#endif
+
+/*  Requests each batch worker keeps in flight through io_uring. */
+#define URING_DEPTH 8
+
+#define ERR_OK          0x00
+#define ERR_USAGE       0x01
+#define ERR_CPRS_FILE   0x02
+#define ERR_UNCPRS      0x04
+#define ERR_OUT_FILE    0x08
+#define ERR_DIFFER      0x10
+
+void* read_file(char* path, size_t* sizeOut, int* mapped);
+void free_file(void* data, size_t size, int mapped);
+int write_file(char* path, void* data, size_t size);
+
+/*  A byte count with an optional K, M or G suffix. 0 if it isn't one. */
+uint64_t parse_size(const char* text);
+
+/*  Output buffer that is kept and grown across decodes. */
+typedef struct scratch_buffer {
+    uint8_t* data;
+    size_t size;
+} scratch_buffer;
+
+uint8_t* scratch_reserve(scratch_buffer* scratch, size_t size);
+
+/*  On-disk cache of decoded outputs keyed by cache_key() of the compressed
+    file, kept under `limit` bytes by evicting the least recently used
+    entries. cache_get() checks the entry against the compressed file
+    `data`, puts the cached output in place as `outPath` (stdout if null)
+    and returns its ERR_* code, or -1 on a miss; cache_put() adds the
+    output of a miss and then does the same, falling back to writing the
+    output directly. Safe to share between threads and processes. */
+typedef struct cache cache;
+
+#define CACHE_LIMIT ((uint64_t)1 << 30)
+
+cache* cache_open(char* dir, uint64_t limit);
+void cache_close(cache* c);
+uint64_t cache_key(const uint8_t* data, size_t size);
+int cache_get(cache* c, uint64_t key, const uint8_t* data, size_t inSize, char* outPath);
+int cache_put(cache* c, uint64_t key, const uint8_t* data, size_t inSize,
+              const uint8_t* out, size_t outLen, char* outPath);
+
+/*  Decodes one file through `scratch`, returning an ERR_* code. With a
+    `c`ache, hits skip the decode altogether. */
+int decompress_file(char* inPath, char* outPath, scratch_buffer* scratch, cache* c);
+
+/*  The decoding half of decompress_file(): decodes the file contents at
+    `data` (one blob or several members) into scratch->data and stores the
+    output length in `outLen`. `name` is only used in messages. */
+int decompress_buffer(const uint8_t* data, size_t size, char* name, scratch_buffer* scratch, size_t* outLen);
+
+/*  The same in two steps, for callers with their own output buffer:
+    decompress_size() is how much room decompress_into() needs (0 when the
+    header is unreadable, which decompress_into() then reports). */
+size_t decompress_size(const uint8_t* data, size_t size);
+int decompress_into(const uint8_t* data, size_t size, char* name, uint8_t* out, size_t* outLen);
+
+/*  Runs task(context, i, scratch) for every i below `count` on `threads`
+    workers, each with its own scratch buffer. threads <= 0 means one per
+    online CPU. */
+typedef void (*pool_task)(void* context, size_t index, scratch_buffer* scratch);
+
+int pool_threads(int requested);
+void pool_run(size_t count, int threads, pool_task task, void* context);
+
+/*  Incremental digests for --verify. hash_final() writes the digest as
+    lowercase hex (big-endian for the integer hashes) into `hex`, which
+    must hold HASH_HEX_SIZE bytes. */
+#define HASH_SHA256     0
+#define HASH_CRC32      1
+#define HASH_XXH64      2
+#define HASH_COUNT      3
+
+#define HASH_HEX_SIZE   65
+
+typedef struct hash_state {
+    int kind;
+    uint64_t total;
+    size_t fill;
+    uint8_t buffer[64];
+    union {
+        uint32_t sha256[8];
+        uint32_t crc32;
+        struct {
+            uint64_t v[4];
+        } xxh64;
+    } u;
+} hash_state;
+
+int hash_lookup(const char* name);
+const char* hash_name(int kind);
+void hash_init(hash_state* state, int kind);
+void hash_update(hash_state* state, const void* data, size_t size);
+void hash_final(hash_state* state, char* hex);
+
+/*  XXH64 of `data` in one go, as a number. */
+uint64_t hash_xxh64(const void* data, size_t size);
+
+/*  Members of a multi-member file and where each one's output goes in the
+    concatenation of them all. */
+typedef struct member {
+    size_t offset;
+    size_t outOffset;
+    cprs_header header;
+    size_t decoded;
+    int status;
+} member;
+
+/*  Returns the number of members if the file is exactly two or more of
+    them back to back, storing them in a malloc'd *members, and 0 for
+    anything else. */
+size_t members_split(const uint8_t* data, size_t size, member** members);
+
+/*  Decodes all members into `out` (room for the sum of their
+    decompressedSizes) on `jobs` workers and returns the length of the
+    concatenated output, or (size_t)-1 after reporting a failed member. */
+size_t members_decode(const uint8_t* data, member* members, size_t count, uint8_t* out, int jobs);
+
+int members_main(const uint8_t* data, member* members, size_t count, char* outPath, int jobs);
+
+/*  A cprs_stream that carries on through each member of a multi-member
+    file, with the same push/pull contract. `count` and the size totals
+    cover the members whose terminator has been reached. */
+typedef struct member_stream {
+    cprs_stream* stream;
+    int state;
+    int unbounded;
+    uint64_t pushed;
+    uint64_t skip;
+    uint8_t sig[4];
+    size_t sigLen;
+    size_t count;
+    uint64_t compressedSize;
+    uint64_t decompressedSize;
+} member_stream;
+
+int member_stream_open(member_stream* s);
+void member_stream_close(member_stream* s);
+int member_stream_push(member_stream* s, const uint8_t* in, size_t inLen, size_t* inUsed);
+size_t member_stream_pull(member_stream* s, uint8_t* out, size_t outCap);
+
+/*  What an end of input leaves: CPRS_STREAM_END after a whole member,
+    CPRS_E_TRUNC in the middle of one. */
+int member_stream_finish(const member_stream* s);
+
+/*  Decodes the pairs through an io_uring pipeline with `depth` requests in
+    flight per worker, filling in `results`. Returns 0 when io_uring isn't
+    available (or depth is 0) so the caller can use the pool instead. */
+int uring_batch_run(char** paths, size_t pairCount, int* results, int jobs, int depth);
+
+int batch_main(char** pairs, size_t pairCount, char* manifestPath, int jobs, int depth, cache* c);
+
+/*  With `head` non-zero only the first `head` bytes of each member are
+    decoded. */
+int scan_main(char* imagePath, char* outPrefix, int jobs, size_t head);
+
+/*  Decodes a single stream through cprs_parallel_begin() and friends on
+    `jobs` workers. */
+int speculative_main(const uint8_t* data, size_t size, char* outPath, int jobs);
+
+/*  Compares the decoded outputs of two images (stdin if null), returning
+    ERR_DIFFER if they differ. */
+int diff_main(char* pathA, char* pathB, int showBytes);
+
+/*  Daemon protocol, in host byte order over a Unix stream socket. Each
+    request names its input by the `pathLen` bytes of path that follow it
+    or, with `pathLen` 0, by a descriptor attached to it; with
+    DAEMON_OUTPUT_FD a descriptor to write the output into is attached
+    after that. The reply carries the request's ERR_* code and, on success
+    without an output descriptor, a memfd holding `outputLen` bytes. */
+#define DAEMON_REQUEST_SIG  0x51525043
+#define DAEMON_REPLY_SIG    0x41525043
+#define DAEMON_OUTPUT_FD    0x01
+#define DAEMON_MAX_FDS      2
+
+typedef struct daemon_request {
+    uint32_t sig;
+    uint32_t pathLen;
+    uint32_t flags;
+    uint32_t reserved;
+} daemon_request;
+
+typedef struct daemon_reply {
+    uint32_t sig;
+    uint32_t status;
+    uint32_t compressedSize;
+    uint32_t decompressedSize;
+    uint64_t outputLen;
+} daemon_reply;
+
+/*  Serves requests on `socketPath` with `jobs` workers until killed. */
+int daemon_main(char* socketPath, int jobs);
+
+int client_main(char* socketPath, char* inPath, char* outPath);
+
+#endif
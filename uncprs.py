@@ -20,6 +20,11 @@
 import struct
 import sys
 
+try:
+    import _uncprs_native as _native
+except ImportError:
+    _native = None
+
 
 ERR_OK        = 0x00
 ERR_USAGE     = 0x01
@@ -62,6 +67,17 @@ def main():
 
 
 def decompress(data):
+    if _native is not None:
+        try:
+            return _native.decompress(data)
+        except ValueError as e:
+            sys.stderr.write(f'Error: {e}\n')
+            return
+
+    return decompress_python(data)
+
+
+def decompress_python(data):
     if len(data) % 4 != 0:
         sys.stderr.write('Error: source buffer not 4-byte aligned\n')
         return
@@ -74,97 +90,79 @@ def decompress(data):
         sys.stderr.write('Error: CPRS signature check failed\n')
         return
 
-    compressedSize, decompressedSize, alpha, beta = \
-            struct.unpack_from('<IIII', data, 4)
+    compressedSize, decompressedSize = struct.unpack_from('<II', data, 4)
 
-    decompressed = bytearray(decompressedSize)
+    # The alpha/beta registers are an LSB-first bitstream starting at word
+    # 3, read here eight bytes at a time into `bits`.
+    data = bytes(data)
+    fromBytes = int.from_bytes
+    lengthGroups = LENGTH_GROUPS
+    distanceCodes = DISTANCE_CODES
 
-    readIndex = 20
-    writeIndex = 0
+    decompressed = bytearray()
+    append = decompressed.append
+    extend = decompressed.extend
 
-    remainingShifts = 0x20
-    currentValue = 0
-    extractedBytes = 0
+    readIndex = 12
+    bits = 0
+    count = 0
     writeCarryByte = 0
 
     while 1:
-        readCarry = 0
-
-        if alpha & 1 == 0:
-            readCarry = alpha >> 9
-            remainingShifts -= 9
-            writeCarryByte = alpha >> 1 & 0xff
-            alpha = extractedBytes & 3
-            extractedBytes += 1
-            currentValue = write_carry(currentValue, alpha, writeCarryByte)
-            if extractedBytes & 3 == 0:
-                struct.pack_into('<I', decompressed, writeIndex, currentValue)
-                writeIndex += 4
-                currentValue = 0
+        if count < 32:
+            # Past the end the slice comes up short and reads as zeroes;
+            # needing more after that means the terminator is missing.
+            if readIndex > len(data):
+                sys.stderr.write('Error: Source buffer truncated\n')
+                return
+            bits |= fromBytes(data[readIndex:readIndex + 8], 'little') << count
+            readIndex += 8
+            count += 64
+
+        if not bits & 1:
+            writeCarryByte = bits >> 1 & 0xff
+            append(writeCarryByte)
+            bits >>= 9
+            count -= 9
+            continue
+
+        lengthMask, lengthShift, lengthBase = lengthGroups[bits >> 1 & 3]
+        length = lengthBase + (bits >> 3 & lengthMask)
+        bits >>= lengthShift
+        distanceMask, distanceShift, distanceBase, bonus = distanceCodes[bits & 0xf]
+        distance = distanceBase + (bits >> 4 & distanceMask)
+        bits >>= distanceShift
+        count -= lengthShift + distanceShift
+
+        if distance >= CPRS_TERM:
+            break
+
+        length += bonus
+        if distance == 0:
+            extend(RUNS[writeCarryByte] * length)
+            continue
+
+        distance *= 2
+        start = len(decompressed) - distance
+        if start < 0:
+            sys.stderr.write('Error: Corrupt bitstream\n')
+            return
+        if distance >= length:
+            extend(decompressed[start:start + length])
         else:
-            uVar9 = CPRS_TABLE[(alpha >> 1 & 3) * 0x04]
-            uVar1 = (alpha >> 3) >> (uVar9 & 0xff)
-            uVar5 = uVar1 >> 4
-            tableIndex = (uVar1 & 0xf) * 0x04 + 0x10
-            uVar1 = CPRS_TABLE[tableIndex]
-            readCarry = uVar5 >> (uVar1 & 0xff)
-            remainingShifts -= uVar9 + 7 + uVar1
-
-            iVar7 = CPRS_TABLE[tableIndex + 2] + ((1 << (uVar1 & 0xff)) - 1 & uVar5)
-            if iVar7 >= CPRS_TERM:
-                break
-
-            iVar6 = (
-                    CPRS_TABLE[(alpha >> 1 & 3) * 0x04 + 2]
-                    + ((1 << (uVar9 & 0xff)) - 1 & alpha >> 3)
-                    + ((CPRS_TABLE[tableIndex + 1] + 0xb) >> 3)
-            )
-
-            if iVar7 == 0:
-                for _ in range(iVar6):
-                    alpha = extractedBytes & 3
-                    extractedBytes += 1
-                    currentValue = write_carry(currentValue, alpha, writeCarryByte)
-                    if extractedBytes & 3 == 0:
-                        struct.pack_into('<I', decompressed, writeIndex, currentValue)
-                        writeIndex += 4
-                        currentValue = 0
-            else:
-                start = extractedBytes - iVar7 * 2
-                for i in range(start, start + iVar6):
-                    if iVar7 * 2 < 4 and (extractedBytes & 3) != 0:
-                        struct.pack_into('<I', decompressed, writeIndex, currentValue)
-
-                    writeCarryByte = decompressed[i]
-                    alpha = extractedBytes & 3
-                    extractedBytes += 1
-                    currentValue = write_carry(currentValue, alpha, writeCarryByte)
-                    if extractedBytes & 3 == 0:
-                        struct.pack_into('<I', decompressed, writeIndex, currentValue)
-                        writeIndex += 4
-                        currentValue = 0
-
-        if remainingShifts < 0:
-            remainingShifts += 0x20
-            readCarry = beta >> (0x20 - remainingShifts)
-            (beta,) = struct.unpack_from('<I', data, readIndex)
-            readIndex += 4
-
-        alpha = (beta << remainingShifts) | readCarry
-        alpha &= 0xffffffff
-
-    if extractedBytes & 3 != 0:
-        struct.pack_into('<I', decompressed, writeIndex, currentValue)
+            extend((decompressed[start:] * (length // distance + 1))[:length])
+        writeCarryByte = decompressed[-1]
+
+    # As in cprs_decode() and so the native decoder: a stream that ends
+    # early gives what it decoded, one that runs past decompressedSize is
+    # corrupt.
+    if len(decompressed) > decompressedSize:
+        sys.stderr.write('Error: Corrupt bitstream\n')
+        return
 
     return decompressed
 
 
-def write_carry(value, byteIndex, carry):
-    value &= ~(0xff << (byteIndex * 8))
-    value |= (carry & 0xff) << (byteIndex * 8)
-    return value
-
-
 CPRS_TERM = 0x10002
 
 
@@ -220,5 +218,22 @@ CPRS_TABLE = [
 ]
 
 
+# Per length group and distance code: mask and size of the extra bits
+# (with the 3 selector and 4 code bits folded into the shift), base, and
+# for distances the length bonus.
+LENGTH_GROUPS = [
+    ((1 << CPRS_TABLE[g * 4]) - 1, 3 + CPRS_TABLE[g * 4], CPRS_TABLE[g * 4 + 2])
+    for g in range(4)
+]
+
+DISTANCE_CODES = [
+    ((1 << CPRS_TABLE[0x10 + c * 4]) - 1, 4 + CPRS_TABLE[0x10 + c * 4],
+     CPRS_TABLE[0x10 + c * 4 + 2], (CPRS_TABLE[0x10 + c * 4 + 1] + 0xb) >> 3)
+    for c in range(16)
+]
+
+RUNS = [bytes([b]) for b in range(256)]
+
+
 if __name__ == '__main__':
     exit(main())
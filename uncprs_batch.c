@@ -0,0 +1,153 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uncprs.h"
+
+/*  Batch mode: decodes many INPUT/OUTPUT pairs on the worker pool and
+    prints one "STATUS<TAB>INPUT" line per pair, in the order given, where
+    STATUS is the ERR_* code a single invocation would have exited with.
+    Where io_uring is available the files go through its pipeline instead,
+    which overlaps reading, decoding and writing. */
+
+typedef struct batch {
+    char** paths;       /* input, output, input, output, ... */
+    int* results;
+    cache* c;
+} batch;
+
+static char** read_manifest(char* path, size_t* pairCount);
+static void batch_task(void* context, size_t index, scratch_buffer* scratch);
+
+int batch_main(char** pairs, size_t pairCount, char* manifestPath, int jobs, int depth, cache* c) {
+    char** manifest = 0;
+    if (manifestPath) {
+        manifest = read_manifest(manifestPath, &pairCount);
+        if (!manifest) {
+            return ERR_USAGE;
+        }
+        pairs = manifest;
+    }
+
+    batch b = { pairs, calloc(pairCount ? pairCount : 1, sizeof(int)), c };
+    if (!b.results) {
+        fprintf(stderr, "Error: Unable to allocate batch state\n");
+        return ERR_UNCPRS;
+    }
+
+    /*  The io_uring pipeline doesn't go through the cache. */
+    if (c || !uring_batch_run(pairs, pairCount, b.results, jobs, depth)) {
+        pool_run(pairCount, jobs, batch_task, &b);
+    }
+
+    int status = ERR_OK;
+    for (size_t i = 0; i < pairCount; ++i) {
+        printf("%d\t%s\n", b.results[i], pairs[2 * i]);
+        status |= b.results[i];
+    }
+
+    if (manifest) {
+        for (size_t i = 0; i < 2 * pairCount; ++i) {
+            free(manifest[i]);
+        }
+        free(manifest);
+    }
+    free(b.results);
+    return status;
+}
+
+static void batch_task(void* context, size_t index, scratch_buffer* scratch) {
+    batch* b = context;
+    b->results[index] = decompress_file(b->paths[2 * index], b->paths[2 * index + 1], scratch, b->c);
+}
+
+/*  One "INPUT<TAB>OUTPUT" pair per line; blank lines and lines starting
+    with '#' are skipped. "-" reads the list from stdin. */
+static char** read_manifest(char* path, size_t* pairCount) {
+    FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Unable to open file %s\n", path);
+        return 0;
+    }
+
+    char** paths = 0;
+    size_t count = 0;
+    size_t capacity = 0;
+    int ok = 1;
+
+    char* line = 0;
+    size_t lineSize = 0;
+    size_t lineNumber = 0;
+    ssize_t length;
+    while (ok && (length = getline(&line, &lineSize, file)) >= 0) {
+        ++lineNumber;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = 0;
+        }
+        if (length == 0 || line[0] == '#') {
+            continue;
+        }
+
+        char* tab = strchr(line, '\t');
+        if (!tab || tab == line || tab[1] == 0) {
+            fprintf(stderr, "Error: %s:%zu: expected INPUT<TAB>OUTPUT\n", path, lineNumber);
+            ok = 0;
+            break;
+        }
+        *tab = 0;
+
+        if (count + 2 > capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char** grown = realloc(paths, capacity * sizeof(char*));
+            if (!grown) {
+                fprintf(stderr, "Error: Unable to allocate manifest\n");
+                ok = 0;
+                break;
+            }
+            paths = grown;
+        }
+        paths[count] = strdup(line);
+        paths[count + 1] = strdup(tab + 1);
+        count += 2;
+        if (!paths[count - 2] || !paths[count - 1]) {
+            fprintf(stderr, "Error: Unable to allocate manifest\n");
+            ok = 0;
+        }
+    }
+
+    free(line);
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    if (!ok) {
+        for (size_t i = 0; i < count; ++i) {
+            free(paths[i]);
+        }
+        free(paths);
+        return 0;
+    }
+
+    *pairCount = count / 2;
+    return paths ? paths : calloc(1, sizeof(char*));
+}
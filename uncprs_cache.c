@@ -0,0 +1,410 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "uncprs.h"
+
+#ifdef HAVE_CACHE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#endif
+
+/*  Content-addressed cache of decoded outputs. An entry is named after the
+    XXH64 of the whole compressed file and its size, and holds a
+    cache_header followed, CACHE_HEADER_SIZE bytes in, by exactly what
+    decoding that file produces. The header carries the file's size, its
+    CPRS header and its SHA-256, and a hit only counts when all three match
+    the file being decoded, so a colliding name is a miss rather than
+    somebody else's output. Entries are written under a temporary name and
+    renamed into place, so a reader never sees a partial one, and any
+    number of workers or processes can share the directory.
+
+    Outputs are opened in place like fopen() would, keeping their links,
+    inode and mode, and the entry's data is cloned into them (FICLONERANGE,
+    on filesystems with reflinks; the header size keeps the data block
+    aligned for it) or else copied. They never share storage with the entry
+    in a way a later write could reach, so the cache can't be changed
+    through an output.
+
+    Hits bump the entry's mtime, and eviction removes the entries with the
+    oldest mtimes until the directory is back under its size limit. */
+
+#define CACHE_COPY_CHUNK    0x10000
+#define CACHE_HEADER_SIZE   4096
+#define CACHE_MAGIC         "uncprs cache 1"
+
+typedef struct cache_header {
+    char magic[16];
+    uint64_t inSize;
+    uint8_t blob[CPRS_HEADER_SIZE];
+    char digest[HASH_HEX_SIZE];
+} cache_header;
+
+struct cache {
+    char* dir;
+    uint64_t limit;
+    uint64_t stored;            /* bytes added since the last eviction pass */
+#ifdef HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+typedef struct cache_entry {
+    struct timespec mtime;
+    uint64_t size;
+    char* name;
+} cache_entry;
+
+static void cache_evict(cache* c);
+
+cache* cache_open(char* dir, uint64_t limit) {
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Unable to create cache directory %s\n", dir);
+        return 0;
+    }
+
+    cache* c = calloc(1, sizeof(cache));
+    if (!c || !(c->dir = strdup(dir))) {
+        fprintf(stderr, "Error: Unable to allocate cache state\n");
+        free(c);
+        return 0;
+    }
+    c->limit = limit;
+    /*  Start with a pass, in case the limit shrank since the last run. */
+    c->stored = limit;
+#ifdef HAVE_THREADS
+    pthread_mutex_init(&c->lock, 0);
+#endif
+    return c;
+}
+
+void cache_close(cache* c) {
+    if (!c) {
+        return;
+    }
+    if (c->stored) {
+        cache_evict(c);
+    }
+#ifdef HAVE_THREADS
+    pthread_mutex_destroy(&c->lock);
+#endif
+    free(c->dir);
+    free(c);
+}
+
+static char* cache_path(cache* c, uint64_t key, size_t inSize) {
+    size_t size = strlen(c->dir) + 48;
+    char* path = malloc(size);
+    if (path) {
+        snprintf(path, size, "%s/%016llx-%zx", c->dir, (unsigned long long)key, inSize);
+    }
+    return path;
+}
+
+static int copy_fd(int in, int out) {
+    uint8_t buffer[CACHE_COPY_CHUNK];
+    ssize_t n;
+    while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t done = 0; done < n;) {
+            ssize_t written = write(out, buffer + done, n - done);
+            if (written <= 0) {
+                return 0;
+            }
+            done += written;
+        }
+    }
+    return n == 0;
+}
+
+/*  What the entry for the compressed file `data` must start with. */
+static void cache_header_make(cache_header* header, const uint8_t* data, size_t size) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header->inSize = size;
+    memcpy(header->blob, data, size < CPRS_HEADER_SIZE ? size : CPRS_HEADER_SIZE);
+
+    hash_state hash;
+    hash_init(&hash, HASH_SHA256);
+    hash_update(&hash, data, size);
+    hash_final(&hash, header->digest);
+}
+
+/*  Puts the output in the entry at `entryPath` in place as `outPath`
+    (stdout if null), or returns -1 if the entry isn't `data`'s. An entry
+    just written from `data` needn't be checked again. */
+static int cache_serve(char* entryPath, char* outPath, const uint8_t* data, size_t size, int check) {
+    int entry = open(entryPath, O_RDONLY);
+    if (entry < 0) {
+        return -1;
+    }
+
+    /*  The cheap fields first, so that most mismatches cost no digest. */
+    cache_header stored;
+    cache_header expected;
+    int match = !check;
+    if (check && pread(entry, &stored, sizeof(stored), 0) == (ssize_t)sizeof(stored)
+            && memcmp(stored.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 && stored.inSize == size
+            && memcmp(stored.blob, data, size < CPRS_HEADER_SIZE ? size : CPRS_HEADER_SIZE) == 0) {
+        cache_header_make(&expected, data, size);
+        match = memcmp(&stored, &expected, sizeof(stored)) == 0;
+    }
+    if (!match || lseek(entry, CACHE_HEADER_SIZE, SEEK_SET) < 0) {
+        close(entry);
+        return -1;
+    }
+
+    int out = outPath ? open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0666) : STDOUT_FILENO;
+    if (out < 0) {
+        fprintf(stderr, "Error: Unable to open file %s for writing\n", outPath);
+        close(entry);
+        return ERR_OUT_FILE;
+    }
+
+    int placed = 0;
+#ifdef FICLONERANGE
+    if (outPath) {
+        struct file_clone_range range = { entry, CACHE_HEADER_SIZE, 0, 0 };
+        placed = ioctl(out, FICLONERANGE, &range) == 0;
+    }
+#endif
+    if (!placed) {
+        placed = copy_fd(entry, out);
+    }
+    if (outPath) {
+        placed = close(out) == 0 && placed;
+    }
+    close(entry);
+
+    if (!placed) {
+        fprintf(stderr, "Error: Failed to write all data to file %s\n", outPath ? outPath : "stdout");
+        return ERR_OUT_FILE;
+    }
+    return ERR_OK;
+}
+
+uint64_t cache_key(const uint8_t* data, size_t size) {
+    return hash_xxh64(data, size);
+}
+
+int cache_get(cache* c, uint64_t key, const uint8_t* data, size_t inSize, char* outPath) {
+    char* path = cache_path(c, key, inSize);
+    if (!path) {
+        return -1;
+    }
+
+    /*  Touch first: an entry evicted in between is just a miss. */
+    int result = -1;
+    if (utimensat(AT_FDCWD, path, 0, 0) == 0) {
+        result = cache_serve(path, outPath, data, inSize, 1);
+    }
+    free(path);
+    return result;
+}
+
+int cache_put(cache* c, uint64_t key, const uint8_t* data, size_t inSize,
+              const uint8_t* out, size_t outLen, char* outPath) {
+    char* path = cache_path(c, key, inSize);
+    size_t tempSize = strlen(c->dir) + 16;
+    char* temp = malloc(tempSize);
+
+    int stored = 0;
+    int fd = -1;
+    if (path && temp) {
+        snprintf(temp, tempSize, "%s/.tmpXXXXXX", c->dir);
+        fd = mkstemp(temp);
+    }
+    if (fd >= 0) {
+        uint8_t header[CACHE_HEADER_SIZE];
+        memset(header, 0, sizeof(header));
+        cache_header_make((cache_header*)header, data, inSize);
+        int ok = write(fd, header, sizeof(header)) == (ssize_t)sizeof(header);
+
+        size_t done = 0;
+        while (ok && done < outLen) {
+            ssize_t written = write(fd, out + done, outLen - done);
+            if (written <= 0) {
+                break;
+            }
+            done += written;
+        }
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0644 & ~mask);
+        stored = close(fd) == 0 && ok && done == outLen && rename(temp, path) == 0;
+        if (!stored) {
+            unlink(temp);
+        }
+    }
+
+    /*  A full or read-only cache mustn't fail the decode. */
+    int result = stored ? cache_serve(path, outPath, data, inSize, 0) : -1;
+    if (result != ERR_OK) {
+        result = write_file(outPath, (void*)out, outLen) ? ERR_OK : ERR_OUT_FILE;
+    }
+
+    if (stored) {
+        int evict = 0;
+#ifdef HAVE_THREADS
+        pthread_mutex_lock(&c->lock);
+#endif
+        c->stored += outLen;
+        if (c->stored >= c->limit / 8) {
+            c->stored = 0;
+            evict = 1;
+        }
+#ifdef HAVE_THREADS
+        pthread_mutex_unlock(&c->lock);
+#endif
+        if (evict) {
+            cache_evict(c);
+        }
+    }
+
+    free(temp);
+    free(path);
+    return result;
+}
+
+static int entry_older(const void* a, const void* b) {
+    const cache_entry* x = a;
+    const cache_entry* y = b;
+    if (x->mtime.tv_sec != y->mtime.tv_sec) {
+        return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    }
+    return (x->mtime.tv_nsec > y->mtime.tv_nsec) - (x->mtime.tv_nsec < y->mtime.tv_nsec);
+}
+
+/*  Deletes the least recently used entries until the directory fits in
+    its limit. Entries other workers are adding or evicting at the same
+    time are fine either way: a vanished file is skipped. */
+static void cache_evict(cache* c) {
+    DIR* dir = opendir(c->dir);
+    if (!dir) {
+        return;
+    }
+
+    cache_entry* entries = 0;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint64_t total = 0;
+    int ok = 1;
+
+    struct dirent* d;
+    while (ok && (d = readdir(dir)) != 0) {
+        if (d->d_name[0] == '.') {
+            continue;
+        }
+
+        size_t pathSize = strlen(c->dir) + strlen(d->d_name) + 2;
+        char* path = malloc(pathSize);
+        struct stat st;
+        if (!path) {
+            ok = 0;
+            break;
+        }
+        snprintf(path, pathSize, "%s/%s", c->dir, d->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            cache_entry* grown = realloc(entries, capacity * sizeof(cache_entry));
+            if (!grown) {
+                free(path);
+                ok = 0;
+                break;
+            }
+            entries = grown;
+        }
+        entries[count].mtime = st.st_mtim;
+        entries[count].size = st.st_size;
+        entries[count].name = path;
+        ++count;
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    if (ok && total > c->limit) {
+        qsort(entries, count, sizeof(cache_entry), entry_older);
+        for (size_t i = 0; i < count && total > c->limit; ++i) {
+            if (unlink(entries[i].name) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+#else
+
+cache* cache_open(char* dir, uint64_t limit) {
+    (void)limit;
+    fprintf(stderr, "Error: Output cache %s not supported on this platform\n", dir);
+    return 0;
+}
+
+void cache_close(cache* c) {
+    (void)c;
+}
+
+uint64_t cache_key(const uint8_t* data, size_t size) {
+    (void)data;
+    (void)size;
+    return 0;
+}
+
+int cache_get(cache* c, uint64_t key, const uint8_t* data, size_t inSize, char* outPath) {
+    (void)c;
+    (void)key;
+    (void)data;
+    (void)inSize;
+    (void)outPath;
+    return -1;
+}
+
+int cache_put(cache* c, uint64_t key, const uint8_t* data, size_t inSize,
+              const uint8_t* out, size_t outLen, char* outPath) {
+    (void)c;
+    (void)key;
+    (void)data;
+    (void)inSize;
+    return write_file(outPath, (void*)out, outLen) ? ERR_OK : ERR_OUT_FILE;
+}
+
+#endif
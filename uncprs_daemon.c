@@ -0,0 +1,682 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uncprs.h"
+
+#ifdef HAVE_DAEMON
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*  Daemon mode: the main thread polls the listening Unix socket and every
+    idle connection, and queues a connection for the `jobs` workers once a
+    request is waiting on it. A worker serves that one request and hands
+    the connection back, so clients holding connections open (or stalled
+    halfway through a request, until DAEMON_TIMEOUT) don't tie workers up,
+    and each worker's scratch buffer stays allocated across requests.
+
+    Requests and replies are the daemon_request and daemon_reply structs
+    of uncprs.h. The input is either a path sent after the request or a
+    descriptor attached to it with SCM_RIGHTS, and is read into memory:
+    the client could truncate a mapped file under the decode, and SIGBUS
+    would take the whole daemon down. Only a memfd sealed against
+    shrinking is mapped. The output is decoded straight into a memfd (an
+    unlinked temporary file where there are no memfds) attached to the
+    reply, or written into an output descriptor the client attached
+    itself, which for the same reason is never mapped. */
+
+#define DAEMON_BACKLOG  64
+#define DAEMON_PATH_MAX 4096
+#define DAEMON_TIMEOUT  5       /* seconds a request or reply may take to cross */
+
+typedef struct daemon_state {
+    int listener;
+    int wake[2];                /* workers hand connections back through this */
+    int* ready;                 /* connections with a request waiting */
+    size_t readyCount;
+    size_t readyCapacity;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} daemon_state;
+
+static char* socketPathToRemove;
+
+static void daemon_stop(int sig) {
+    (void)sig;
+    if (socketPathToRemove) {
+        unlink(socketPathToRemove);
+    }
+    _exit(ERR_OK);
+}
+
+static int send_all(int fd, const void* data, size_t size) {
+    const uint8_t* p = data;
+    while (size) {
+        ssize_t n = send(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        size -= n;
+    }
+    return 1;
+}
+
+static int recv_all(int fd, void* data, size_t size) {
+    uint8_t* p = data;
+    while (size) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        size -= n;
+    }
+    return 1;
+}
+
+/*  Sends or receives `size` bytes with up to DAEMON_MAX_FDS descriptors
+    riding on the first of them. */
+static int send_fds(int fd, const void* data, size_t size, const int* fds, int fdCount) {
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * DAEMON_MAX_FDS)];
+    } control;
+    struct iovec iov = { (void*)data, size };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fdCount) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.space;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+        struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+        memcpy(CMSG_DATA(c), fds, sizeof(int) * fdCount);
+    }
+
+    ssize_t n;
+    do {
+        n = sendmsg(fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    return n > 0 && send_all(fd, (const uint8_t*)data + n, size - n);
+}
+
+static int recv_fds(int fd, void* data, size_t size, int* fds, int* fdCount) {
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * DAEMON_MAX_FDS)];
+    } control;
+    struct iovec iov = { data, size };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+
+    *fdCount = 0;
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return 0;
+    }
+
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            int count = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            for (int i = 0; i < count; ++i) {
+                int received;
+                memcpy(&received, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                if (*fdCount < DAEMON_MAX_FDS) {
+                    fds[(*fdCount)++] = received;
+                } else {
+                    close(received);
+                }
+            }
+        }
+    }
+    return recv_all(fd, (uint8_t*)data + n, size - n);
+}
+
+/*  Reads the input into a buffer, unless it is a memfd sealed against
+    shrinking, which is safe to map. */
+static void* read_fd(int fd, size_t* sizeOut, int* mapped) {
+    struct stat st;
+    *mapped = 0;
+    int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+#ifdef F_GET_SEALS
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (regular && seals >= 0 && (seals & F_SEAL_SHRINK) && st.st_size > 0) {
+        void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            *mapped = 1;
+            *sizeOut = st.st_size;
+            return data;
+        }
+    }
+#endif
+
+    uint8_t* buffer = 0;
+    size_t size = 0;
+    /*  One more than the file size, so that the read seeing its end needs
+        no second allocation. */
+    size_t capacity = regular && st.st_size > 0 ? (size_t)st.st_size + 1 : 0;
+    while (1) {
+        if (size == capacity || !buffer) {
+            capacity = capacity > size ? capacity : capacity ? capacity * 2 : 0x10000;
+            uint8_t* grown = realloc(buffer, capacity);
+            if (!grown) {
+                free(buffer);
+                return 0;
+            }
+            buffer = grown;
+        }
+        /*  From the start of a file, as a mapping would be, and without
+            moving the offset the client shares with us. */
+        ssize_t n = regular ? pread(fd, buffer + size, capacity - size, size)
+                            : read(fd, buffer + size, capacity - size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            free(buffer);
+            return 0;
+        }
+        if (n == 0) {
+            break;
+        }
+        size += n;
+    }
+    *sizeOut = size;
+    return buffer;
+}
+
+static int output_fd(void) {
+#ifdef __linux__
+    int memfd = memfd_create("uncprs", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd >= 0) {
+        return memfd;
+    }
+#endif
+    const char* dir = getenv("TMPDIR");
+    char path[DAEMON_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/uncprs.XXXXXX", dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+}
+
+/*  Decodes `data` into a fresh output_fd() through a mapping of it, and
+    seals it where it can so the client can map it without fear of it
+    shrinking. Returns the descriptor, or -1 with `status` set. */
+static int output_decode(const uint8_t* data, size_t size, char* name, size_t* outLen, uint32_t* status) {
+    int fd = output_fd();
+    size_t total = decompress_size(data, size);
+    void* out = MAP_FAILED;
+    if (fd >= 0 && (total == 0 || posix_fallocate(fd, 0, total) == 0)) {
+        out = mmap(0, total ? total : 1, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (out == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", total);
+        *status = ERR_OUT_FILE;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    *outLen = 0;
+    *status = decompress_into(data, size, name, out, outLen);
+    munmap(out, total ? total : 1);
+    if (*status == ERR_OK && *outLen != total && ftruncate(fd, *outLen) != 0) {
+        *status = ERR_OUT_FILE;
+    }
+    if (*status != ERR_OK) {
+        close(fd);
+        return -1;
+    }
+#ifdef F_ADD_SEALS
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    return fd;
+}
+
+/*  A regular file is rewritten from the start; a pipe, socket or terminal
+    can't be truncated or seeked, so the output is just written to it. */
+static int write_fd(int fd, const uint8_t* data, size_t size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return 0;
+    }
+    if (S_ISREG(st.st_mode) && (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0)) {
+        return 0;
+    }
+    while (size) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        data += n;
+        size -= n;
+    }
+    return 1;
+}
+
+/*  Handles one request whose header is in `request`, returning 0 once the
+    connection should be dropped. */
+static int daemon_request_serve(int conn, const daemon_request* request, int* fds, int fdCount,
+                                scratch_buffer* scratch) {
+    daemon_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.sig = DAEMON_REPLY_SIG;
+
+    int wantOut = (request->flags & DAEMON_OUTPUT_FD) != 0;
+    int inFd = -1;
+    int outFd = -1;
+    int ownOut = 0;
+    char* path = 0;
+    int keep = 1;
+
+    if (request->pathLen) {
+        if (request->pathLen >= DAEMON_PATH_MAX || !(path = malloc(request->pathLen + 1))
+                || !recv_all(conn, path, request->pathLen)) {
+            keep = 0;
+            goto done;
+        }
+        path[request->pathLen] = 0;
+        if (fdCount != wantOut) {
+            reply.status = ERR_USAGE;
+            goto reply;
+        }
+        outFd = wantOut ? fds[0] : -1;
+        if ((inFd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+            fprintf(stderr, "Error: Unable to open file %s\n", path);
+            reply.status = ERR_CPRS_FILE;
+            goto reply;
+        }
+    } else {
+        if (fdCount != 1 + wantOut) {
+            reply.status = ERR_USAGE;
+            goto reply;
+        }
+        inFd = fds[0];
+        outFd = wantOut ? fds[1] : -1;
+    }
+
+    size_t size = 0;
+    int mapped = 0;
+    uint8_t* data = read_fd(inFd, &size, &mapped);
+    if (!data) {
+        reply.status = ERR_CPRS_FILE;
+        goto reply;
+    }
+
+    cprs_header header;
+    if (cprs_member(data, size, 0, &header) == CPRS_OK) {
+        reply.compressedSize = header.compressedSize;
+        reply.decompressedSize = header.decompressedSize;
+    }
+
+    size_t outLen = 0;
+    if (outFd < 0) {
+        outFd = output_decode(data, size, path, &outLen, &reply.status);
+        ownOut = 1;
+    } else {
+        reply.status = decompress_buffer(data, size, path, scratch, &outLen);
+        if (reply.status == ERR_OK && !write_fd(outFd, scratch->data, outLen)) {
+            reply.status = ERR_OUT_FILE;
+        }
+    }
+    free_file(data, size, mapped);
+    if (reply.status == ERR_OK) {
+        reply.outputLen = outLen;
+    }
+
+reply:
+    keep = send_fds(conn, &reply, sizeof(reply), &outFd, reply.status == ERR_OK && ownOut);
+
+done:
+    if (ownOut && outFd >= 0) {
+        close(outFd);
+    }
+    for (int i = 0; i < fdCount; ++i) {
+        close(fds[i]);
+    }
+    if (request->pathLen && inFd >= 0) {
+        close(inFd);
+    }
+    free(path);
+    return keep;
+}
+
+static void* daemon_worker(void* arg) {
+    daemon_state* state = arg;
+    scratch_buffer scratch = { 0, 0 };
+
+    while (1) {
+        pthread_mutex_lock(&state->lock);
+        while (state->readyCount == 0) {
+            pthread_cond_wait(&state->cond, &state->lock);
+        }
+        int conn = state->ready[--state->readyCount];
+        pthread_mutex_unlock(&state->lock);
+
+        daemon_request request;
+        int fds[DAEMON_MAX_FDS];
+        int fdCount;
+        int keep = recv_fds(conn, &request, sizeof(request), fds, &fdCount);
+        if (keep && request.sig != DAEMON_REQUEST_SIG) {
+            for (int i = 0; i < fdCount; ++i) {
+                close(fds[i]);
+            }
+            keep = 0;
+        }
+        if (keep) {
+            keep = daemon_request_serve(conn, &request, fds, fdCount, &scratch);
+        }
+
+        if (!keep || write(state->wake[1], &conn, sizeof(conn)) != sizeof(conn)) {
+            close(conn);
+        }
+    }
+
+    free(scratch.data);
+    return 0;
+}
+
+/*  Watches the listener, the wake pipe and the idle connections, and
+    queues each connection that becomes readable (a request, a hangup or
+    an error, all of which a worker sorts out). Runs until a signal. */
+static void daemon_dispatch(daemon_state* state) {
+    size_t capacity = 64;
+    size_t count = 2;
+    struct pollfd* watched = malloc(capacity * sizeof(struct pollfd));
+    if (!watched) {
+        fprintf(stderr, "Error: Unable to allocate poll set\n");
+        return;
+    }
+    watched[0].fd = state->listener;
+    watched[1].fd = state->wake[0];
+    watched[0].events = watched[1].events = POLLIN;
+
+    while (1) {
+        if (poll(watched, count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error: poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        /*  Backwards, so the last entry moved into a removed one's place
+            has already been looked at. */
+        for (size_t i = count; i-- > 2;) {
+            if (!watched[i].revents) {
+                continue;
+            }
+            pthread_mutex_lock(&state->lock);
+            if (state->readyCount == state->readyCapacity) {
+                size_t grown = state->readyCapacity ? state->readyCapacity * 2 : 64;
+                int* ready = realloc(state->ready, grown * sizeof(int));
+                if (!ready) {
+                    pthread_mutex_unlock(&state->lock);
+                    close(watched[i].fd);
+                    watched[i] = watched[--count];
+                    continue;
+                }
+                state->ready = ready;
+                state->readyCapacity = grown;
+            }
+            state->ready[state->readyCount++] = watched[i].fd;
+            pthread_cond_signal(&state->cond);
+            pthread_mutex_unlock(&state->lock);
+            watched[i] = watched[--count];
+        }
+
+        int incoming[64];
+        size_t incomingCount = 0;
+        if (watched[1].revents & POLLIN) {
+            ssize_t n = read(state->wake[0], incoming, sizeof(incoming));
+            incomingCount = n > 0 ? (size_t)n / sizeof(int) : 0;
+        }
+        if (watched[0].revents & POLLIN) {
+            int conn = accept(state->listener, 0, 0);
+            if (conn >= 0) {
+                struct timeval timeout = { DAEMON_TIMEOUT, 0 };
+                fcntl(conn, F_SETFD, FD_CLOEXEC);
+                setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                incoming[incomingCount++] = conn;
+            }
+        }
+
+        for (size_t i = 0; i < incomingCount; ++i) {
+            if (count == capacity) {
+                struct pollfd* grown = realloc(watched, capacity * 2 * sizeof(struct pollfd));
+                if (!grown) {
+                    close(incoming[i]);
+                    continue;
+                }
+                watched = grown;
+                capacity *= 2;
+            }
+            watched[count].fd = incoming[i];
+            watched[count].events = POLLIN;
+            watched[count].revents = 0;
+            count += 1;
+        }
+    }
+
+    for (size_t i = 2; i < count; ++i) {
+        close(watched[i].fd);
+    }
+    free(watched);
+}
+
+int daemon_main(char* socketPath, int jobs) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s too long\n", socketPath);
+        return ERR_USAGE;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        fprintf(stderr, "Error: Unable to create socket: %s\n", strerror(errno));
+        return ERR_OUT_FILE;
+    }
+
+    /*  A socket left behind by a daemon that didn't get to clean up is
+        replaced. One that a daemon still answers on is refused, and
+        anything else at the path is left alone. */
+    struct stat st;
+    if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int answered = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        int refused = !answered && errno == ECONNREFUSED;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (answered) {
+            fprintf(stderr, "Error: A daemon is already listening on %s\n", socketPath);
+            close(listener);
+            return ERR_USAGE;
+        }
+        if (refused) {
+            unlink(socketPath);
+        }
+    }
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, DAEMON_BACKLOG) != 0) {
+        fprintf(stderr, "Error: Unable to listen on %s: %s\n", socketPath, strerror(errno));
+        close(listener);
+        return ERR_OUT_FILE;
+    }
+
+    socketPathToRemove = socketPath;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, daemon_stop);
+    signal(SIGTERM, daemon_stop);
+
+    daemon_state state;
+    memset(&state, 0, sizeof(state));
+    state.listener = listener;
+    pthread_mutex_init(&state.lock, 0);
+    pthread_cond_init(&state.cond, 0);
+
+    int threads = pool_threads(jobs);
+    int started = 0;
+    if (pipe(state.wake) == 0) {
+        fcntl(state.wake[0], F_SETFD, FD_CLOEXEC);
+        fcntl(state.wake[1], F_SETFD, FD_CLOEXEC);
+        for (; started < threads; ++started) {
+            pthread_t worker;
+            if (pthread_create(&worker, 0, daemon_worker, &state) != 0) {
+                break;
+            }
+            pthread_detach(worker);
+        }
+    }
+    if (started == 0) {
+        fprintf(stderr, "Error: Unable to start workers\n");
+    } else {
+        daemon_dispatch(&state);
+    }
+
+    close(listener);
+    unlink(socketPath);
+    return ERR_OUT_FILE;
+}
+
+int client_main(char* socketPath, char* inPath, char* outPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s too long\n", socketPath);
+        return ERR_USAGE;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0 || connect(conn, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Error: Unable to connect to %s\n", socketPath);
+        if (conn >= 0) {
+            close(conn);
+        }
+        return ERR_USAGE;
+    }
+
+    int inFd = inPath ? open(inPath, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+    if (inFd < 0) {
+        fprintf(stderr, "Error: Unable to open file %s\n", inPath);
+        close(conn);
+        return ERR_CPRS_FILE;
+    }
+
+    daemon_request request = { DAEMON_REQUEST_SIG, 0, 0, 0 };
+    daemon_reply reply;
+    int fds[DAEMON_MAX_FDS];
+    int fdCount = 0;
+    int ok = send_fds(conn, &request, sizeof(request), &inFd, 1)
+        && recv_fds(conn, &reply, sizeof(reply), fds, &fdCount)
+        && reply.sig == DAEMON_REPLY_SIG;
+    if (inPath) {
+        close(inFd);
+    }
+    close(conn);
+
+    if (!ok) {
+        fprintf(stderr, "Error: No reply from %s\n", socketPath);
+        for (int i = 0; i < fdCount; ++i) {
+            close(fds[i]);
+        }
+        return ERR_UNCPRS;
+    }
+
+    int result = (int)reply.status;
+    if (result == ERR_OK) {
+        size_t size = (size_t)reply.outputLen;
+        void* data = 0;
+        if (fdCount == 1 && size) {
+            data = mmap(0, size, PROT_READ, MAP_SHARED, fds[0], 0);
+        }
+        if (fdCount != 1 || (size && data == MAP_FAILED)) {
+            fprintf(stderr, "Error: No output from %s\n", socketPath);
+            result = ERR_UNCPRS;
+        } else {
+            result = write_file(outPath, data, size) ? ERR_OK : ERR_OUT_FILE;
+            if (size) {
+                munmap(data, size);
+            }
+        }
+    }
+    for (int i = 0; i < fdCount; ++i) {
+        close(fds[i]);
+    }
+    return result;
+}
+
+#else
+
+int daemon_main(char* socketPath, int jobs) {
+    (void)jobs;
+    fprintf(stderr, "Error: Daemon mode on %s not supported on this platform\n", socketPath);
+    return ERR_USAGE;
+}
+
+int client_main(char* socketPath, char* inPath, char* outPath) {
+    (void)inPath;
+    (void)outPath;
+    fprintf(stderr, "Error: Daemon mode on %s not supported on this platform\n", socketPath);
+    return ERR_USAGE;
+}
+
+#endif
@@ -0,0 +1,291 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "uncprs.h"
+
+/*  Diff mode: runs a member_stream over each image in lockstep and prints a
+    "OFFSET<TAB>LENGTH" line for every range of the decoded outputs that
+    differs, with the first DIFF_SHOW bytes of each side appended when
+    asked. Past the end of the shorter output, the rest of the longer one
+    is a difference too. Only the stream windows and a chunk of each side
+    are ever held, and equal stretches are skipped a block at a time with
+    memcmp(), which the C library vectorizes. */
+
+#define DIFF_CHUNK  0x10000
+#define DIFF_BLOCK  256
+#define DIFF_SHOW   32
+
+typedef struct diff_source {
+    char* path;
+    FILE* file;
+    member_stream stream;
+    uint8_t* in;
+    size_t inLen;
+    size_t inPos;
+    int status;
+} diff_source;
+
+typedef struct diff_range {
+    int open;
+    uint64_t start;
+    uint64_t present[2];        /* bytes of the range each side has */
+    size_t shown[2];
+    uint8_t bytes[2][DIFF_SHOW];
+} diff_range;
+
+static int source_open(diff_source* s, char* path);
+static void source_close(diff_source* s);
+static size_t source_read(diff_source* s, uint8_t* out, size_t cap);
+static size_t diff_equal(const uint8_t* a, const uint8_t* b, size_t n);
+static size_t diff_unequal(const uint8_t* a, const uint8_t* b, size_t n);
+static void range_extend(diff_range* r, uint64_t offset, const uint8_t* a, const uint8_t* b, size_t n);
+static void range_close(diff_range* r, uint64_t end, int showBytes);
+
+int diff_main(char* pathA, char* pathB, int showBytes) {
+    diff_source sources[2];
+    memset(sources, 0, sizeof(sources));
+    uint8_t* chunks[2] = { malloc(DIFF_CHUNK), malloc(DIFF_CHUNK) };
+
+    int result = ERR_OK;
+    if (!chunks[0] || !chunks[1]) {
+        fprintf(stderr, "Error: Unable to allocate diff buffers\n");
+        result = ERR_UNCPRS;
+    }
+    for (int i = 0; i < 2 && result == ERR_OK; ++i) {
+        result = source_open(&sources[i], i ? pathB : pathA);
+    }
+
+    diff_range range;
+    memset(&range, 0, sizeof(range));
+    uint64_t offset = 0;
+    int differ = 0;
+
+    while (result == ERR_OK) {
+        size_t lengths[2];
+        for (int i = 0; i < 2; ++i) {
+            lengths[i] = source_read(&sources[i], chunks[i], DIFF_CHUNK);
+            if (sources[i].status < 0) {
+                fprintf(stderr, "Error: %s: %s\n", sources[i].path, cprs_strerror(sources[i].status));
+                result = ERR_UNCPRS;
+            }
+        }
+        if (result != ERR_OK) {
+            break;
+        }
+
+        const uint8_t* a = chunks[0];
+        const uint8_t* b = chunks[1];
+        size_t common = lengths[0] < lengths[1] ? lengths[0] : lengths[1];
+        size_t pos = 0;
+        while (pos < common) {
+            size_t equal = diff_equal(a + pos, b + pos, common - pos);
+            if (equal) {
+                range_close(&range, offset + pos, showBytes);
+                pos += equal;
+            }
+            size_t unequal = diff_unequal(a + pos, b + pos, common - pos);
+            if (unequal) {
+                range_extend(&range, offset + pos, a + pos, b + pos, unequal);
+                differ = 1;
+                pos += unequal;
+            }
+        }
+        offset += common;
+
+        if (lengths[0] != lengths[1]) {
+            /*  One side ended: the rest of the other is all difference. */
+            int longer = lengths[1] > lengths[0];
+            size_t extra = lengths[longer] - common;
+            const uint8_t* rest = chunks[longer] + common;
+            do {
+                range_extend(&range, offset, longer ? 0 : rest, longer ? rest : 0, extra);
+                offset += extra;
+                extra = source_read(&sources[longer], chunks[longer], DIFF_CHUNK);
+                rest = chunks[longer];
+            } while (extra && sources[longer].status >= 0);
+            differ = 1;
+            if (sources[longer].status < 0) {
+                fprintf(stderr, "Error: %s: %s\n", sources[longer].path, cprs_strerror(sources[longer].status));
+                result = ERR_UNCPRS;
+            }
+            break;
+        }
+        if (common < DIFF_CHUNK) {
+            break;
+        }
+    }
+
+    if (result == ERR_OK) {
+        range_close(&range, offset, showBytes);
+        if (differ) {
+            result = ERR_DIFFER;
+        }
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        source_close(&sources[i]);
+        free(chunks[i]);
+    }
+    return result;
+}
+
+static int source_open(diff_source* s, char* path) {
+    s->path = path ? path : "-";
+    s->file = path ? fopen(path, "rb") : stdin;
+    if (!s->file) {
+        fprintf(stderr, "Error: Unable to open file %s\n", path);
+        return ERR_CPRS_FILE;
+    }
+    int opened = member_stream_open(&s->stream);
+    s->in = malloc(DIFF_CHUNK);
+    if (!opened || !s->in) {
+        fprintf(stderr, "Error: Unable to allocate stream buffers\n");
+        return ERR_UNCPRS;
+    }
+    return ERR_OK;
+}
+
+static void source_close(diff_source* s) {
+    if (s->file && s->file != stdin) {
+        fclose(s->file);
+    }
+    member_stream_close(&s->stream);
+    free(s->in);
+}
+
+/*  Fills `out` as far as the stream goes: short only at its end or on an
+    error, which is left in s->status. */
+static size_t source_read(diff_source* s, uint8_t* out, size_t cap) {
+    size_t got = 0;
+    while (got < cap) {
+        got += member_stream_pull(&s->stream, out + got, cap - got);
+        if (got == cap || s->status == CPRS_STREAM_END || s->status < 0) {
+            break;
+        }
+
+        if (s->inPos == s->inLen && s->status != CPRS_STREAM_FULL) {
+            s->inLen = fread(s->in, 1, DIFF_CHUNK, s->file);
+            s->inPos = 0;
+            if (s->inLen == 0) {
+                s->status = member_stream_finish(&s->stream);
+                break;
+            }
+        }
+
+        size_t used;
+        s->status = member_stream_push(&s->stream, s->in + s->inPos, s->inLen - s->inPos, &used);
+        s->inPos += used;
+    }
+    return got;
+}
+
+static uint64_t load64le(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+/*  Length of the common prefix of a and b. */
+static size_t diff_equal(const uint8_t* a, const uint8_t* b, size_t n) {
+    size_t i = 0;
+    while (i + DIFF_BLOCK <= n && memcmp(a + i, b + i, DIFF_BLOCK) == 0) {
+        i += DIFF_BLOCK;
+    }
+#if defined(__GNUC__)
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x = load64le(a + i) ^ load64le(b + i);
+        if (x != 0) {
+            return i + (__builtin_ctzll(x) >> 3);
+        }
+    }
+#endif
+    while (i < n && a[i] == b[i]) {
+        ++i;
+    }
+    return i;
+}
+
+/*  Length of the prefix in which every byte of a differs from b's. */
+static size_t diff_unequal(const uint8_t* a, const uint8_t* b, size_t n) {
+    size_t i = 0;
+#if defined(__GNUC__)
+    for (; i + 8 <= n; i += 8) {
+        /*  Flags the equal (zero) bytes of the XOR; the lowest flag is
+            always a real one. */
+        uint64_t x = load64le(a + i) ^ load64le(b + i);
+        uint64_t zero = (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+        if (zero != 0) {
+            return i + (__builtin_ctzll(zero) >> 3);
+        }
+    }
+#endif
+    while (i < n && a[i] != b[i]) {
+        ++i;
+    }
+    return i;
+}
+
+/*  `a` or `b` is null past the end of that side. */
+static void range_extend(diff_range* r, uint64_t offset, const uint8_t* a, const uint8_t* b, size_t n) {
+    if (!r->open) {
+        r->open = 1;
+        r->start = offset;
+        memset(r->present, 0, sizeof(r->present));
+        memset(r->shown, 0, sizeof(r->shown));
+    }
+    const uint8_t* sides[2] = { a, b };
+    for (int i = 0; i < 2; ++i) {
+        size_t take = DIFF_SHOW - r->shown[i] < n ? DIFF_SHOW - r->shown[i] : n;
+        if (sides[i]) {
+            memcpy(r->bytes[i] + r->shown[i], sides[i], take);
+            r->shown[i] += take;
+            r->present[i] += n;
+        }
+    }
+}
+
+static void range_close(diff_range* r, uint64_t end, int showBytes) {
+    if (!r->open) {
+        return;
+    }
+    r->open = 0;
+
+    printf("0x%08llx\t%llu", (unsigned long long)r->start, (unsigned long long)(end - r->start));
+    if (showBytes) {
+        for (int i = 0; i < 2; ++i) {
+            putchar('\t');
+            if (r->shown[i] == 0) {
+                putchar('-');
+            }
+            for (size_t k = 0; k < r->shown[i]; ++k) {
+                printf("%02x", r->bytes[i][k]);
+            }
+            if (r->shown[i] < r->present[i]) {
+                fputs("...", stdout);
+            }
+        }
+    }
+    putchar('\n');
+}
@@ -0,0 +1,378 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "uncprs.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HASH_SHA_NI
+#include <immintrin.h>
+#endif
+
+/*  Digests for --verify, fed incrementally so the output never has to be
+    held in memory. Self-contained so the tool keeps building without
+    OpenSSL, zlib or libxxhash. */
+
+static const char* const hashNames[HASH_COUNT] = { "sha256", "crc32", "xxh64" };
+
+int hash_lookup(const char* name) {
+    for (int kind = 0; kind < HASH_COUNT; ++kind) {
+        if (strcmp(name, hashNames[kind]) == 0) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+const char* hash_name(int kind) {
+    return hashNames[kind];
+}
+
+/*  SHA-256, FIPS 180-4. */
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block_portable(uint32_t* h, const uint8_t* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16
+             | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = k + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+#ifdef HASH_SHA_NI
+/*  The same on the SHA extensions, which keep the state as ABEF/CDGH
+    halves and do two rounds per instruction. Each group of four rounds
+    takes the next four schedule words, kept in a ring of the last 16. */
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_ni(uint32_t* h, const uint8_t* p, size_t count) {
+    const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bll, 0x0405060700010203ll);
+    __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[0]), 0xb1);
+    __m128i hgfe = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[4]), 0x1b);
+    __m128i abef = _mm_alignr_epi8(dcba, hgfe, 8);
+    __m128i cdgh = _mm_blend_epi16(hgfe, dcba, 0xf0);
+
+    for (; count; --count, p += 64) {
+        __m128i savedAbef = abef;
+        __m128i savedCdgh = cdgh;
+        __m128i w[4];
+#pragma GCC unroll 16
+        for (int g = 0; g < 16; ++g) {
+            __m128i m;
+            if (g < 4) {
+                m = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16 * g)), swap);
+            } else {
+                m = _mm_add_epi32(_mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]),
+                                  _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+                m = _mm_sha256msg2_epu32(m, w[(g + 3) & 3]);
+            }
+            w[g & 3] = m;
+            __m128i k = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)&sha256K[4 * g]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, k);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(k, 0x0e));
+        }
+        abef = _mm_add_epi32(abef, savedAbef);
+        cdgh = _mm_add_epi32(cdgh, savedCdgh);
+    }
+
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+    _mm_storeu_si128((__m128i*)&h[0], _mm_blend_epi16(feba, dchg, 0xf0));
+    _mm_storeu_si128((__m128i*)&h[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+
+/*  1 when the CPU has them, resolved once. Racing first calls all store
+    the same value. */
+static int sha256NiSupported = -1;
+#endif
+
+static void sha256_blocks(uint32_t* h, const uint8_t* p, size_t count) {
+#ifdef HASH_SHA_NI
+    int ni = __atomic_load_n(&sha256NiSupported, __ATOMIC_RELAXED);
+    if (ni < 0) {
+        __builtin_cpu_init();
+        ni = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+        __atomic_store_n(&sha256NiSupported, ni, __ATOMIC_RELAXED);
+    }
+    if (ni) {
+        sha256_blocks_ni(h, p, count);
+        return;
+    }
+#endif
+    for (; count; --count, p += 64) {
+        sha256_block_portable(h, p);
+    }
+}
+
+/*  CRC-32 as used by zlib and cksum -a crc32b, slicing by 4. */
+
+static uint32_t crcTable[4][256];
+
+static void crc32_init_table(void) {
+    if (crcTable[0][1]) {
+        return;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c >> 1) ^ (0xedb88320 & (0 - (c & 1)));
+        }
+        crcTable[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int t = 1; t < 4; ++t) {
+            crcTable[t][i] = (crcTable[t - 1][i] >> 8) ^ crcTable[0][crcTable[t - 1][i] & 0xff];
+        }
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t* p, size_t n) {
+    crc = ~crc;
+    for (; n >= 4; n -= 4, p += 4) {
+        crc ^= (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        crc = crcTable[3][crc & 0xff] ^ crcTable[2][(crc >> 8) & 0xff]
+            ^ crcTable[1][(crc >> 16) & 0xff] ^ crcTable[0][crc >> 24];
+    }
+    for (; n; --n, ++p) {
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *p) & 0xff];
+    }
+    return ~crc;
+}
+
+/*  XXH64 with seed 0, as printed by xxhsum -H1. */
+
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+#define ROL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static uint64_t load64le(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    acc = ROL64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh64_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+static uint64_t xxh64_final(const hash_state* state) {
+    const uint64_t* v = state->u.xxh64.v;
+    uint64_t total = state->total;
+    uint64_t h;
+
+    if (total >= 32) {
+        h = ROL64(v[0], 1) + ROL64(v[1], 7) + ROL64(v[2], 12) + ROL64(v[3], 18);
+        for (int i = 0; i < 4; ++i) {
+            h = xxh64_merge(h, v[i]);
+        }
+    } else {
+        h = XXH_P5;
+    }
+    h += total;
+
+    const uint8_t* p = state->buffer;
+    size_t n = state->fill;
+    for (; n >= 8; n -= 8, p += 8) {
+        h ^= xxh64_round(0, load64le(p));
+        h = ROL64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (n >= 4) {
+        h ^= (uint64_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24) * XXH_P1;
+        h = ROL64(h, 23) * XXH_P2 + XXH_P3;
+        n -= 4;
+        p += 4;
+    }
+    for (; n; --n, ++p) {
+        h ^= *p * XXH_P5;
+        h = ROL64(h, 11) * XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+void hash_init(hash_state* state, int kind) {
+    static const uint32_t sha256H[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memset(state, 0, sizeof(*state));
+    state->kind = kind;
+    switch (kind) {
+    case HASH_SHA256:
+        memcpy(state->u.sha256, sha256H, sizeof(sha256H));
+        break;
+    case HASH_CRC32:
+        crc32_init_table();
+        break;
+    case HASH_XXH64:
+        state->u.xxh64.v[0] = XXH_P1 + XXH_P2;
+        state->u.xxh64.v[1] = XXH_P2;
+        state->u.xxh64.v[2] = 0;
+        state->u.xxh64.v[3] = 0 - XXH_P1;
+        break;
+    }
+}
+
+void hash_update(hash_state* state, const void* data, size_t size) {
+    const uint8_t* p = data;
+    state->total += size;
+
+    if (state->kind == HASH_CRC32) {
+        state->u.crc32 = crc32_update(state->u.crc32, p, size);
+        return;
+    }
+
+    /*  Both block hashes go through the same buffer: 64-byte blocks for
+        SHA-256, 32-byte stripes for XXH64. */
+    size_t block = state->kind == HASH_SHA256 ? 64 : 32;
+
+    if (state->fill) {
+        size_t take = block - state->fill < size ? block - state->fill : size;
+        memcpy(state->buffer + state->fill, p, take);
+        state->fill += take;
+        p += take;
+        size -= take;
+        if (state->fill < block) {
+            return;
+        }
+        state->fill = 0;
+        if (state->kind == HASH_SHA256) {
+            sha256_blocks(state->u.sha256, state->buffer, 1);
+        } else {
+            for (int i = 0; i < 4; ++i) {
+                state->u.xxh64.v[i] = xxh64_round(state->u.xxh64.v[i], load64le(state->buffer + 8 * i));
+            }
+        }
+    }
+
+    if (state->kind == HASH_SHA256 && size >= block) {
+        size_t count = size / block;
+        sha256_blocks(state->u.sha256, p, count);
+        p += count * block;
+        size -= count * block;
+    }
+    for (; size >= block; size -= block, p += block) {
+        for (int i = 0; i < 4; ++i) {
+            state->u.xxh64.v[i] = xxh64_round(state->u.xxh64.v[i], load64le(p + 8 * i));
+        }
+    }
+
+    memcpy(state->buffer, p, size);
+    state->fill = size;
+}
+
+static void to_hex(char* hex, const uint8_t* bytes, size_t n) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < n; ++i) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0xf];
+    }
+    hex[2 * n] = 0;
+}
+
+void hash_final(hash_state* state, char* hex) {
+    uint8_t digest[32];
+
+    switch (state->kind) {
+    case HASH_SHA256: {
+        uint64_t bits = state->total * 8;
+        uint8_t pad[72] = { 0x80 };
+        size_t padLen = (state->fill < 56 ? 56 : 120) - state->fill;
+        for (int i = 0; i < 8; ++i) {
+            pad[padLen + i] = (uint8_t)(bits >> (56 - 8 * i));
+        }
+        hash_update(state, pad, padLen + 8);
+        for (int i = 0; i < 8; ++i) {
+            for (int b = 0; b < 4; ++b) {
+                digest[4 * i + b] = (uint8_t)(state->u.sha256[i] >> (24 - 8 * b));
+            }
+        }
+        to_hex(hex, digest, 32);
+        break;
+    }
+    case HASH_CRC32:
+    case HASH_XXH64: {
+        uint64_t value = state->kind == HASH_CRC32 ? state->u.crc32 : xxh64_final(state);
+        int n = state->kind == HASH_CRC32 ? 4 : 8;
+        for (int i = 0; i < n; ++i) {
+            digest[i] = (uint8_t)(value >> (8 * (n - 1 - i)));
+        }
+        to_hex(hex, digest, n);
+        break;
+    }
+    }
+}
+
+uint64_t hash_xxh64(const void* data, size_t size) {
+    hash_state state;
+    hash_init(&state, HASH_XXH64);
+    hash_update(&state, data, size);
+    return xxh64_final(&state);
+}
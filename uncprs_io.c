@@ -0,0 +1,151 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "uncprs.h"
+
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define FILE_READ_INITIAL   0x10000
+
+/*  Regular files are mapped read-only; anything else (stdin, pipes) is read
+    into a buffer that doubles as it fills. */
+void* read_file(char* path, size_t* sizeOut, int* mapped) {
+    *mapped = 0;
+
+#ifdef HAVE_MMAP
+    int fd = path ? open(path, O_RDONLY) : -1;
+    if (path && fd < 0) {
+        fprintf(stderr, "Error: Unable to open file %s\n", path);
+        return 0;
+    }
+
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            close(fd);
+            posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+            *mapped = 1;
+            *sizeOut = st.st_size;
+            return data;
+        }
+    }
+
+    FILE* file = path ? fdopen(fd, "rb") : stdin;
+#else
+    FILE* file = path ? fopen(path, "rb") : stdin;
+#endif
+    if (!file) {
+        fprintf(stderr, "Error: Unable to open file %s\n", path);
+        return 0;
+    }
+
+    uint8_t* buffer = 0;
+    size_t bufferSize = 0;
+    size_t totalBytesRead = 0;
+
+    size_t bytesRead = 0;
+    do {
+        totalBytesRead += bytesRead;
+
+        if (totalBytesRead >= bufferSize) {
+            size_t newSize = bufferSize ? bufferSize * 2 : FILE_READ_INITIAL;
+            uint8_t* newBuffer = realloc(buffer, newSize);
+            if (!newBuffer) {
+                fprintf(stderr, "Error: Unable to allocate %zu bytes\n", newSize);
+                free(buffer);
+                buffer = 0;
+                break;
+            }
+            buffer = newBuffer;
+            bufferSize = newSize;
+        }
+    } while ((bytesRead = fread(buffer + totalBytesRead, 1, bufferSize - totalBytesRead, file)) != 0);
+
+    if (path) {
+        fclose(file);
+    }
+
+    *sizeOut = totalBytesRead;
+    return buffer;
+}
+
+void free_file(void* data, size_t size, int mapped) {
+#ifdef HAVE_MMAP
+    if (mapped) {
+        munmap(data, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)mapped;
+    free(data);
+}
+
+int write_file(char* path, void* data, size_t size) {
+    FILE* file = path ? fopen(path, "wb") : stdout;
+    if (!file) {
+        fprintf(stderr, "Error: Unable to open file %s for writing\n", path);
+        return 0;
+    }
+
+    size_t written = fwrite(data, 1, size, file);
+    if (written != size) {
+        fprintf(stderr, "Error: Failed to write all data to file %s\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    if (path) {
+        fclose(file);
+    }
+    return 1;
+}
+
+uint8_t* scratch_reserve(scratch_buffer* scratch, size_t size) {
+    if (size > scratch->size || !scratch->data) {
+        uint8_t* data = realloc(scratch->data, size ? size : 1);
+        if (!data) {
+            return 0;
+        }
+        scratch->data = data;
+        scratch->size = size;
+    }
+    return scratch->data;
+}
+
+uint64_t parse_size(const char* text) {
+    char* end;
+    uint64_t size = strtoull(text, &end, 0);
+    switch (*end) {
+    case 'K': case 'k': size <<= 10; ++end; break;
+    case 'M': case 'm': size <<= 20; ++end; break;
+    case 'G': case 'g': size <<= 30; ++end; break;
+    }
+    return *end == 0 ? size : 0;
+}
@@ -0,0 +1,247 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "uncprs.h"
+
+/*  Multi-member files: blobs back to back, each found by jumping the
+    previous one's compressedSize. The members are independent, so each is
+    decoded on the worker pool straight into its own slot of the output,
+    and the slots are closed up afterwards in case one came out short. */
+
+typedef struct members_job {
+    const uint8_t* data;
+    member* members;
+    uint8_t* out;
+} members_job;
+
+static void members_task(void* context, size_t index, scratch_buffer* scratch);
+
+size_t members_split(const uint8_t* data, size_t size, member** membersOut) {
+    member* members = 0;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t outOffset = 0;
+
+    size_t offset = 0;
+    cprs_header header;
+    while (offset < size && cprs_member(data, size, offset, &header) == CPRS_OK) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            member* grown = realloc(members, capacity * sizeof(member));
+            if (!grown) {
+                free(members);
+                return 0;
+            }
+            members = grown;
+        }
+
+        member* m = &members[count++];
+        m->offset = offset;
+        m->outOffset = outOffset;
+        m->header = header;
+        m->decoded = 0;
+        m->status = CPRS_OK;
+
+        offset += header.compressedSize;
+        outOffset += header.decompressedSize;
+    }
+
+    /*  Anything other than an exact run of two or more is left to the
+        single-blob path, which has always ignored trailing bytes. */
+    if (offset != size || count < 2) {
+        free(members);
+        return 0;
+    }
+
+    *membersOut = members;
+    return count;
+}
+
+size_t members_decode(const uint8_t* data, member* members, size_t count, uint8_t* out, int jobs) {
+    members_job job = { data, members, out };
+    pool_run(count, jobs, members_task, &job);
+
+    size_t outLen = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (members[i].status != CPRS_OK) {
+            fprintf(stderr, "Error: member %zu at 0x%08zx: %s\n", i, members[i].offset,
+                    cprs_strerror(members[i].status));
+            return (size_t)-1;
+        }
+        if (outLen != members[i].outOffset) {
+            memmove(out + outLen, out + members[i].outOffset, members[i].decoded);
+        }
+        outLen += members[i].decoded;
+    }
+    return outLen;
+}
+
+static void members_task(void* context, size_t index, scratch_buffer* scratch) {
+    members_job* job = context;
+    member* m = &job->members[index];
+    (void)scratch;
+
+    m->status = cprs_decode(job->data + m->offset, m->header.compressedSize,
+                            job->out + m->outOffset, m->header.decompressedSize, &m->decoded);
+}
+
+int members_main(const uint8_t* data, member* members, size_t count, char* outPath, int jobs) {
+    member* last = &members[count - 1];
+    size_t total = last->outOffset + last->header.decompressedSize;
+
+    uint8_t* out = malloc(total ? total : 1);
+    if (!out) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", total);
+        return ERR_UNCPRS;
+    }
+
+    size_t outLen = members_decode(data, members, count, out, jobs);
+    if (outLen == (size_t)-1) {
+        free(out);
+        return ERR_UNCPRS;
+    }
+
+    int success = write_file(outPath, out, outLen);
+    free(out);
+    return success ? ERR_OK : ERR_OUT_FILE;
+}
+
+/*  The same walk for the stream modes, which see the file a chunk at a
+    time. Each member gets no more than its compressedSize, since
+    cprs_stream reads a few bytes ahead of the token it is on and would
+    otherwise eat into the next one; after its terminator the rest of the
+    member is skipped and the next four bytes decide whether another one
+    starts there. */
+
+#define MEMBER_DECODE   0
+#define MEMBER_SKIP     1
+#define MEMBER_NEXT     2
+#define MEMBER_START    3
+#define MEMBER_DONE     4
+
+int member_stream_open(member_stream* s) {
+    memset(s, 0, sizeof(*s));
+    s->stream = cprs_stream_create();
+    return s->stream != 0;
+}
+
+void member_stream_close(member_stream* s) {
+    cprs_stream_destroy(s->stream);
+    s->stream = 0;
+}
+
+int member_stream_push(member_stream* s, const uint8_t* in, size_t inLen, size_t* inUsed) {
+    size_t used = 0;
+    int status = CPRS_OK;
+
+    while (status == CPRS_OK) {
+        size_t available = inLen - used;
+
+        if (s->state == MEMBER_DECODE) {
+            cprs_header header;
+            int known = cprs_stream_header(s->stream, &header) == CPRS_OK;
+            size_t limit = available;
+            if (!s->unbounded) {
+                uint64_t end = known ? header.compressedSize : CPRS_HEADER_SIZE;
+                uint64_t left = end > s->pushed ? end - s->pushed : 0;
+                if (limit > left) {
+                    limit = left;
+                }
+            }
+
+            size_t n;
+            status = cprs_stream_push(s->stream, in + used, limit, &n);
+            used += n;
+            s->pushed += n;
+
+            if (status == CPRS_STREAM_END) {
+                cprs_stream_header(s->stream, &header);
+                s->compressedSize += header.compressedSize;
+                s->decompressedSize += header.decompressedSize;
+                s->count += 1;
+                s->skip = header.compressedSize > s->pushed ? header.compressedSize - s->pushed : 0;
+                if (s->unbounded) {
+                    s->state = MEMBER_DONE;
+                    break;
+                }
+                s->state = MEMBER_SKIP;
+                status = CPRS_OK;
+            } else if (status == CPRS_OK && used < inLen && known) {
+                /*  compressedSize ran out before the terminator. Like
+                    cprs_decode(), go by the data rather than the field:
+                    this member runs to the end of the input. */
+                s->unbounded = 1;
+            } else if (status == CPRS_OK && used == inLen) {
+                break;
+            }
+        } else if (s->state == MEMBER_SKIP) {
+            size_t n = s->skip < available ? (size_t)s->skip : available;
+            used += n;
+            s->skip -= n;
+            if (s->skip) {
+                break;
+            }
+            s->state = MEMBER_NEXT;
+            s->sigLen = 0;
+        } else if (s->state == MEMBER_NEXT) {
+            size_t n = 4 - s->sigLen < available ? 4 - s->sigLen : available;
+            memcpy(s->sig + s->sigLen, in + used, n);
+            used += n;
+            s->sigLen += n;
+            if (s->sigLen < 4) {
+                break;
+            }
+            if (memcmp(s->sig, "CPRS", 4) != 0) {
+                /*  Trailing bytes, ignored as the single-blob path does. */
+                s->state = MEMBER_DONE;
+                status = CPRS_STREAM_END;
+                break;
+            }
+            /*  The caller drains the ring before it is reset. */
+            s->state = MEMBER_START;
+            status = CPRS_STREAM_FULL;
+        } else if (s->state == MEMBER_START) {
+            cprs_stream_reset(s->stream);
+            cprs_stream_push(s->stream, s->sig, 4, 0);
+            s->pushed = 4;
+            s->unbounded = 0;
+            s->state = MEMBER_DECODE;
+        } else {
+            status = CPRS_STREAM_END;
+        }
+    }
+
+    *inUsed = used;
+    return status;
+}
+
+size_t member_stream_pull(member_stream* s, uint8_t* out, size_t outCap) {
+    return cprs_stream_pull(s->stream, out, outCap);
+}
+
+int member_stream_finish(const member_stream* s) {
+    /*  Between members (or short of a member's compressedSize after its
+        terminator, which a single stream has always let pass) is an end. */
+    int between = s->state == MEMBER_SKIP || s->state == MEMBER_NEXT || s->state == MEMBER_DONE;
+    return s->count && between ? CPRS_STREAM_END : CPRS_E_TRUNC;
+}
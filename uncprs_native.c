@@ -0,0 +1,95 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*  Python binding of cprs_decode(), imported by uncprs.py as
+    uncprs._native. Build it with `make python`. */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "cprs.h"
+
+PyDoc_STRVAR(decompress_doc,
+"decompress(data) -> bytearray\n"
+"\n"
+"Decodes a CPRS blob from any object supporting the buffer protocol\n"
+"(bytes, bytearray, memoryview, mmap, ...) without copying it. The GIL\n"
+"is released while decoding. A stream that ends before decompressedSize\n"
+"gives only the bytes it decoded. Raises ValueError on a malformed blob,\n"
+"including one that decodes to more than decompressedSize.");
+
+static PyObject* decompress(PyObject* self, PyObject* arg) {
+    (void)self;
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) != 0) {
+        return 0;
+    }
+
+    cprs_header header;
+    int status = cprs_header_peek(view.buf, view.len, &header);
+    if (status != CPRS_OK) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, cprs_strerror(status));
+        return 0;
+    }
+
+    PyObject* out = PyByteArray_FromStringAndSize(0, header.decompressedSize);
+    if (!out) {
+        PyBuffer_Release(&view);
+        return 0;
+    }
+
+    /*  Nothing else can see `out` yet, so it is safe to fill without the
+        GIL; `view` keeps the input alive and pinned. */
+    size_t decoded = 0;
+    Py_BEGIN_ALLOW_THREADS
+    status = cprs_decode(view.buf, view.len, PyByteArray_AS_STRING(out), header.decompressedSize, &decoded);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&view);
+
+    if (status != CPRS_OK) {
+        Py_DECREF(out);
+        PyErr_SetString(PyExc_ValueError, cprs_strerror(status));
+        return 0;
+    }
+
+    if (decoded != header.decompressedSize && PyByteArray_Resize(out, decoded) != 0) {
+        Py_DECREF(out);
+        return 0;
+    }
+    return out;
+}
+
+static PyMethodDef methods[] = {
+    { "decompress", decompress, METH_O, decompress_doc },
+    { 0, 0, 0, 0 }
+};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT,
+    "_uncprs_native",
+    "Native CPRS decoder for uncprs.py.",
+    -1,
+    methods,
+    0, 0, 0, 0
+};
+
+PyMODINIT_FUNC PyInit__uncprs_native(void) {
+    return PyModule_Create(&module);
+}
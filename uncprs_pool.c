@@ -0,0 +1,118 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "uncprs.h"
+
+#ifdef HAVE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/*  Worker pool: every worker takes the next unclaimed index until none are
+    left, so long and short jobs balance out without any up-front split. */
+
+typedef struct pool {
+    size_t count;
+    size_t next;
+    pool_task task;
+    void* context;
+#ifdef HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+} pool;
+
+static int pool_claim(pool* p, size_t* index);
+static void* pool_worker(void* arg);
+
+int pool_threads(int requested) {
+    if (requested > 0) {
+        return requested;
+    }
+#ifdef HAVE_THREADS
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online > 0) {
+        return (int)online;
+    }
+#endif
+    return 1;
+}
+
+void pool_run(size_t count, int threads, pool_task task, void* context) {
+    pool p = { .count = count, .next = 0, .task = task, .context = context };
+
+    threads = pool_threads(threads);
+    if ((size_t)threads > count) {
+        threads = (int)count;
+    }
+
+#ifdef HAVE_THREADS
+    pthread_mutex_init(&p.lock, 0);
+
+    pthread_t* workers = threads > 1 ? malloc(threads * sizeof(pthread_t)) : 0;
+    int started = 0;
+    for (; workers && started < threads; ++started) {
+        if (pthread_create(&workers[started], 0, pool_worker, &p) != 0) {
+            break;
+        }
+    }
+
+    /*  Whatever couldn't be handed to a thread runs here. */
+    if (started == 0) {
+        pool_worker(&p);
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(workers[i], 0);
+    }
+
+    free(workers);
+    pthread_mutex_destroy(&p.lock);
+#else
+    pool_worker(&p);
+#endif
+}
+
+static int pool_claim(pool* p, size_t* index) {
+#ifdef HAVE_THREADS
+    pthread_mutex_lock(&p->lock);
+#endif
+    int claimed = p->next < p->count;
+    if (claimed) {
+        *index = p->next++;
+    }
+#ifdef HAVE_THREADS
+    pthread_mutex_unlock(&p->lock);
+#endif
+    return claimed;
+}
+
+static void* pool_worker(void* arg) {
+    pool* p = arg;
+    scratch_buffer scratch = { 0, 0 };
+
+    size_t index;
+    while (pool_claim(p, &index)) {
+        p->task(p->context, index, &scratch);
+    }
+
+    free(scratch.data);
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cprs.h"
+#include "uncprs.h"
+
+/*  Scan mode: finds every CPRS member in a raw image, decodes them on the
+    worker pool to PREFIX.000, PREFIX.001, ... and prints a manifest line
+    "STATUS<TAB>OFFSET<TAB>COMPRESSED<TAB>DECOMPRESSED<TAB>OUTPUT" for each,
+    in image order. */
+
+typedef struct scan_member {
+    size_t offset;
+    cprs_header header;
+    char* outPath;
+    int result;
+} scan_member;
+
+typedef struct scan {
+    const uint8_t* image;
+    scan_member* members;
+    size_t head;
+} scan;
+
+static void scan_task(void* context, size_t index, scratch_buffer* scratch);
+
+int scan_main(char* imagePath, char* outPrefix, int jobs, size_t head) {
+    size_t imageSize = 0;
+    int mapped = 0;
+    uint8_t* image = read_file(imagePath, &imageSize, &mapped);
+    if (!image) {
+        return ERR_CPRS_FILE;
+    }
+
+    scan_member* members = 0;
+    size_t count = 0;
+    size_t capacity = 0;
+    int status = ERR_OK;
+
+    size_t offset = 0;
+    cprs_header header;
+    while (cprs_scan(image, imageSize, offset, &offset, &header) == CPRS_OK) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            scan_member* grown = realloc(members, capacity * sizeof(scan_member));
+            if (!grown) {
+                fprintf(stderr, "Error: Unable to allocate scan state\n");
+                status = ERR_UNCPRS;
+                break;
+            }
+            members = grown;
+        }
+
+        size_t pathSize = strlen(outPrefix) + 24;
+        scan_member* member = &members[count++];
+        member->offset = offset;
+        member->header = header;
+        member->result = ERR_OK;
+        member->outPath = malloc(pathSize);
+        if (!member->outPath) {
+            fprintf(stderr, "Error: Unable to allocate scan state\n");
+            --count;
+            status = ERR_UNCPRS;
+            break;
+        }
+        snprintf(member->outPath, pathSize, "%s.%03zu", outPrefix, count - 1);
+
+        /*  Members don't nest, so carry on after this one. */
+        offset += header.compressedSize;
+    }
+
+    if (status == ERR_OK && count == 0) {
+        fprintf(stderr, "Error: No CPRS members found in %s\n", imagePath ? imagePath : "-");
+        status = ERR_UNCPRS;
+    }
+
+    scan s = { image, members, head };
+    pool_run(count, jobs, scan_task, &s);
+
+    for (size_t i = 0; i < count; ++i) {
+        printf("%d\t0x%08zx\t%u\t%u\t%s\n", members[i].result, members[i].offset,
+               members[i].header.compressedSize, members[i].header.decompressedSize,
+               members[i].outPath);
+        status |= members[i].result;
+        free(members[i].outPath);
+    }
+
+    free(members);
+    free_file(image, imageSize, mapped);
+    return status;
+}
+
+static void scan_task(void* context, size_t index, scratch_buffer* scratch) {
+    scan* s = context;
+    scan_member* member = &s->members[index];
+
+    size_t size = member->header.decompressedSize;
+    if (s->head && s->head < size) {
+        size = s->head;
+    }
+
+    uint8_t* buffer = scratch_reserve(scratch, size);
+    if (!buffer) {
+        fprintf(stderr, "Error: Unable to allocate %zu bytes\n", size);
+        member->result = ERR_UNCPRS;
+        return;
+    }
+
+    size_t decompressedSize = 0;
+    int status = s->head
+        ? cprs_decode_head(s->image + member->offset, member->header.compressedSize,
+                           buffer, size, &decompressedSize)
+        : cprs_decode(s->image + member->offset, member->header.compressedSize,
+                      buffer, size, &decompressedSize);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: member at 0x%08zx: %s\n", member->offset, cprs_strerror(status));
+        member->result = ERR_UNCPRS;
+        return;
+    }
+
+    member->result = write_file(member->outPath, buffer, decompressedSize) ? ERR_OK : ERR_OUT_FILE;
+}
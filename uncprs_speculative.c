@@ -0,0 +1,65 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cprs.h"
+#include "uncprs.h"
+
+/*  Speculative decoding of a single stream: cprs_parallel_begin() splits
+    it, the pool decodes the regions and cprs_parallel_finish() stitches
+    them together, or decodes serially if they don't line up. */
+
+static void speculative_task(void* context, size_t index, scratch_buffer* scratch) {
+    (void)scratch;
+    cprs_parallel_decode(context, index);
+}
+
+int speculative_main(const uint8_t* data, size_t size, char* outPath, int jobs) {
+    cprs_header header;
+    int status = cprs_header_peek(data, size, &header);
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        return ERR_UNCPRS;
+    }
+
+    uint8_t* out = malloc(header.decompressedSize ? header.decompressedSize : 1);
+    if (!out) {
+        fprintf(stderr, "Error: Unable to allocate %u bytes\n", header.decompressedSize);
+        return ERR_UNCPRS;
+    }
+
+    int threads = pool_threads(jobs);
+    cprs_parallel* job;
+    status = cprs_parallel_begin(data, size, out, header.decompressedSize, threads, &job);
+    size_t outLen = 0;
+    if (status == CPRS_OK) {
+        pool_run(cprs_parallel_regions(job), threads, speculative_task, job);
+        status = cprs_parallel_finish(job, &outLen, 0);
+    }
+    if (status != CPRS_OK) {
+        fprintf(stderr, "Error: %s\n", cprs_strerror(status));
+        free(out);
+        return ERR_UNCPRS;
+    }
+
+    int success = write_file(outPath, out, outLen);
+    free(out);
+    return success ? ERR_OK : ERR_OUT_FILE;
+}
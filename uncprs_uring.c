@@ -0,0 +1,486 @@
+/*  seag-cprs
+ *  Copyright (C) 2024  wilszdev
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uncprs.h"
+
+#ifdef HAVE_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+/*  io_uring batch pipeline. Each pool worker owns a ring and `depth`
+    slots. A free slot claims the next pair and reads its input into one
+    of the worker's registered buffers (or a buffer of its own if the
+    input doesn't fit); when the read completes it is decoded right away
+    and the output is handed back to the ring to write. Reads and writes
+    of the other slots keep going in the kernel while a slot decodes, so
+    disk and CPU stay busy together. The slots are recycled, buffers and
+    all, for the whole batch.
+
+    No liburing: the ring is set up and driven with the raw system calls,
+    which is all the little this needs. */
+
+#define URING_SLOT_SIZE 0x100000
+
+#define SLOT_FREE       0
+#define SLOT_READING    1
+#define SLOT_WRITING    2
+
+typedef struct uring {
+    int fd;
+    unsigned entries;
+    unsigned pending;           /* queued but not yet submitted */
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqArray;
+    unsigned sqMask;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* sqRing;
+    size_t sqRingSize;
+    void* cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+} uring;
+
+typedef struct slot {
+    int state;
+    size_t index;
+    int fd;
+    uint8_t* fixed;             /* this slot's registered buffer, or 0 */
+    uint8_t* data;              /* fixed, or big when the input is larger */
+    uint8_t* big;
+    size_t bigSize;
+    size_t size;
+    size_t done;
+    scratch_buffer out;
+} slot;
+
+typedef struct uring_batch {
+    char** paths;
+    int* results;
+    size_t count;
+    size_t next;
+    unsigned depth;
+    pthread_mutex_t lock;
+} uring_batch;
+
+static int uring_open(uring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return 0;
+    }
+    ring->entries = params.sq_entries;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cqRingSize > ring->sqRingSize) {
+        ring->sqRingSize = ring->cqRingSize;
+    }
+
+    ring->sqRing = mmap(0, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqRing = single || ring->sqRing == MAP_FAILED
+        ? ring->sqRing
+        : mmap(0, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = ring->cqRing == MAP_FAILED
+        ? MAP_FAILED
+        : mmap(0, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+            munmap(ring->cqRing, ring->cqRingSize);
+        }
+        if (ring->sqRing != MAP_FAILED) {
+            munmap(ring->sqRing, ring->sqRingSize);
+        }
+        close(ring->fd);
+        return 0;
+    }
+
+    uint8_t* sq = ring->sqRing;
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+
+    uint8_t* cq = ring->cqRing;
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 1;
+}
+
+/*  Whether the kernel has every opcode the pipeline uses. IORING_OP_READ
+    and IORING_OP_WRITE only arrived in 5.6, a release after the probe
+    itself, so a kernel that can't be probed doesn't have them either. */
+static int uring_probe(uring* ring) {
+    static const int needed[] = { IORING_OP_READ_FIXED, IORING_OP_READ, IORING_OP_WRITE };
+    unsigned ops = IORING_OP_WRITE + 1;
+    struct io_uring_probe* probe = calloc(1, sizeof(struct io_uring_probe) + ops * sizeof(struct io_uring_probe_op));
+    int supported = probe && syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, ops) == 0;
+    for (size_t i = 0; supported && i < sizeof(needed) / sizeof(needed[0]); ++i) {
+        supported = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+static void uring_close(uring* ring) {
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+/*  Queues one request. Every slot has at most one in flight and the ring
+    has an entry per slot, so there is always room. */
+static void uring_push(uring* ring, int opcode, int fd, void* buffer, size_t length, size_t offset,
+                       int bufferIndex, size_t userData) {
+    unsigned tail = *ring->sqTail;
+    unsigned i = tail & ring->sqMask;
+
+    struct io_uring_sqe* sqe = &ring->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t)opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = length > 0x40000000 ? 0x40000000 : (uint32_t)length;
+    sqe->off = offset;
+    sqe->buf_index = (uint16_t)bufferIndex;
+    sqe->user_data = userData;
+
+    ring->sqArray[i] = i;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending += 1;
+}
+
+/*  Submits whatever is queued and waits for at least one completion. */
+static int uring_wait(uring* ring) {
+    for (;;) {
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 1, IORING_ENTER_GETEVENTS, 0, 0);
+        if (submitted >= 0) {
+            ring->pending -= (unsigned)submitted;
+            return 1;
+        }
+        if (errno != EINTR) {
+            return 0;
+        }
+    }
+}
+
+static int uring_claim(uring_batch* b, size_t* index) {
+    pthread_mutex_lock(&b->lock);
+    int claimed = b->next < b->count;
+    if (claimed) {
+        *index = b->next++;
+    }
+    pthread_mutex_unlock(&b->lock);
+    return claimed;
+}
+
+static void slot_read(uring* ring, slot* s, size_t id) {
+    uint8_t* buffer = s->data + s->done;
+    size_t length = s->size - s->done;
+    if (s->data == s->fixed) {
+        uring_push(ring, IORING_OP_READ_FIXED, s->fd, buffer, length, s->done, (int)id, id);
+    } else {
+        uring_push(ring, IORING_OP_READ, s->fd, buffer, length, s->done, 0, id);
+    }
+}
+
+static void slot_write(uring* ring, slot* s, size_t id) {
+    uring_push(ring, IORING_OP_WRITE, s->fd, s->out.data + s->done, s->size - s->done, s->done, 0, id);
+}
+
+/*  Opens the input of pair `index` and starts reading it. Returns 0 with
+    the pair's result filled in if there is nothing to read. */
+static int slot_start(uring_batch* b, uring* ring, slot* s, size_t id, size_t index) {
+    char* inPath = b->paths[2 * index];
+    s->index = index;
+    s->done = 0;
+
+    struct stat st;
+    s->fd = open(inPath, O_RDONLY);
+    if (s->fd < 0 || fstat(s->fd, &st) != 0) {
+        fprintf(stderr, "Error: Unable to open file %s\n", inPath);
+        if (s->fd >= 0) {
+            close(s->fd);
+        }
+        b->results[index] = ERR_CPRS_FILE;
+        return 0;
+    }
+    s->size = st.st_size;
+
+    if (s->fixed && s->size <= URING_SLOT_SIZE) {
+        s->data = s->fixed;
+    } else {
+        if (s->size > s->bigSize) {
+            uint8_t* big = realloc(s->big, s->size);
+            if (!big) {
+                fprintf(stderr, "Error: Unable to allocate %zu bytes\n", s->size);
+                close(s->fd);
+                b->results[index] = ERR_CPRS_FILE;
+                return 0;
+            }
+            s->big = big;
+            s->bigSize = s->size;
+        }
+        s->data = s->big;
+    }
+
+    s->state = SLOT_READING;
+    if (s->size == 0) {
+        /*  Nothing to read; let the decoder report it like any other
+            short input. */
+        return -1;
+    }
+    slot_read(ring, s, id);
+    return 1;
+}
+
+/*  The input is all in: decode it and start writing the output. */
+static void slot_decode(uring_batch* b, uring* ring, slot* s, size_t id) {
+    char* inPath = b->paths[2 * s->index];
+    char* outPath = b->paths[2 * s->index + 1];
+    close(s->fd);
+
+    size_t outLen = 0;
+    int result = decompress_buffer(s->data, s->size, inPath, &s->out, &outLen);
+    if (result != ERR_OK) {
+        b->results[s->index] = result;
+        s->state = SLOT_FREE;
+        return;
+    }
+
+    s->fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (s->fd < 0) {
+        fprintf(stderr, "Error: Unable to open file %s for writing\n", outPath);
+        b->results[s->index] = ERR_OUT_FILE;
+        s->state = SLOT_FREE;
+        return;
+    }
+
+    s->state = SLOT_WRITING;
+    s->size = outLen;
+    s->done = 0;
+    if (outLen == 0) {
+        b->results[s->index] = close(s->fd) == 0 ? ERR_OK : ERR_OUT_FILE;
+        s->state = SLOT_FREE;
+        return;
+    }
+    slot_write(ring, s, id);
+}
+
+static void slot_complete(uring_batch* b, uring* ring, slot* s, size_t id, int res) {
+    if (s->state == SLOT_READING) {
+        if (res <= 0) {
+            fprintf(stderr, "Error: Unable to read file %s\n", b->paths[2 * s->index]);
+            close(s->fd);
+            b->results[s->index] = ERR_CPRS_FILE;
+            s->state = SLOT_FREE;
+            return;
+        }
+        s->done += res;
+        if (s->done < s->size) {
+            slot_read(ring, s, id);
+        } else {
+            slot_decode(b, ring, s, id);
+        }
+        return;
+    }
+
+    char* outPath = b->paths[2 * s->index + 1];
+    if (res <= 0) {
+        fprintf(stderr, "Error: Failed to write all data to file %s\n", outPath);
+        close(s->fd);
+        b->results[s->index] = ERR_OUT_FILE;
+        s->state = SLOT_FREE;
+        return;
+    }
+    s->done += res;
+    if (s->done < s->size) {
+        slot_write(ring, s, id);
+        return;
+    }
+    if (close(s->fd) != 0) {
+        fprintf(stderr, "Error: Failed to write all data to file %s\n", outPath);
+        b->results[s->index] = ERR_OUT_FILE;
+    } else {
+        b->results[s->index] = ERR_OK;
+    }
+    s->state = SLOT_FREE;
+}
+
+static void uring_worker(void* context, size_t worker, scratch_buffer* scratch) {
+    uring_batch* b = context;
+    unsigned depth = b->depth;
+    (void)worker;
+
+    uring ring;
+    slot* slots = calloc(depth, sizeof(slot));
+    uint8_t* arena = 0;
+    if (!slots || !uring_open(&ring, depth)) {
+        /*  No ring after all: decode this worker's share the plain way. */
+        free(slots);
+        size_t index;
+        while (uring_claim(b, &index)) {
+            b->results[index] = decompress_file(b->paths[2 * index], b->paths[2 * index + 1], scratch, 0);
+        }
+        return;
+    }
+
+    /*  One registered buffer per slot. Without them (locked memory limit,
+        say) everything is read into the slots' own buffers instead. */
+    struct iovec* iov = malloc(depth * sizeof(struct iovec));
+    arena = mmap(0, (size_t)depth * URING_SLOT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena != MAP_FAILED && iov) {
+        for (unsigned i = 0; i < depth; ++i) {
+            iov[i].iov_base = arena + (size_t)i * URING_SLOT_SIZE;
+            iov[i].iov_len = URING_SLOT_SIZE;
+        }
+        if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iov, depth) == 0) {
+            for (unsigned i = 0; i < depth; ++i) {
+                slots[i].fixed = iov[i].iov_base;
+            }
+        }
+    }
+    free(iov);
+
+    int claiming = 1;
+    for (;;) {
+        unsigned busy = 0;
+        for (unsigned i = 0; i < depth; ++i) {
+            size_t index;
+            while (claiming && slots[i].state == SLOT_FREE) {
+                if (!uring_claim(b, &index)) {
+                    claiming = 0;
+                    break;
+                }
+                int started = slot_start(b, &ring, &slots[i], i, index);
+                if (started < 0) {
+                    slot_decode(b, &ring, &slots[i], i);
+                }
+            }
+            busy += slots[i].state != SLOT_FREE;
+        }
+
+        if (busy == 0) {
+            break;
+        }
+        if (!uring_wait(&ring)) {
+            fprintf(stderr, "Error: io_uring_enter failed\n");
+            for (unsigned i = 0; i < depth; ++i) {
+                if (slots[i].state != SLOT_FREE) {
+                    close(slots[i].fd);
+                    b->results[slots[i].index] = ERR_UNCPRS;
+                }
+            }
+            break;
+        }
+
+        unsigned head = *ring.cqHead;
+        while (head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring.cqes[head & ring.cqMask];
+            size_t id = (size_t)cqe->user_data;
+            int res = cqe->res;
+            __atomic_store_n(ring.cqHead, ++head, __ATOMIC_RELEASE);
+            slot_complete(b, &ring, &slots[id], id, res);
+        }
+    }
+
+    uring_close(&ring);
+    for (unsigned i = 0; i < depth; ++i) {
+        free(slots[i].big);
+        free(slots[i].out.data);
+    }
+    if (arena != MAP_FAILED) {
+        munmap(arena, (size_t)depth * URING_SLOT_SIZE);
+    }
+    free(slots);
+}
+
+int uring_batch_run(char** paths, size_t pairCount, int* results, int jobs, int depth) {
+    uring ring;
+    if (depth <= 0 || !uring_open(&ring, (unsigned)depth)) {
+        return 0;
+    }
+    int supported = uring_probe(&ring);
+    uring_close(&ring);
+    if (!supported) {
+        return 0;
+    }
+
+    uring_batch b;
+    b.paths = paths;
+    b.results = results;
+    b.count = pairCount;
+    b.next = 0;
+    b.depth = (unsigned)depth;
+    pthread_mutex_init(&b.lock, 0);
+
+    /*  Each task is a whole worker that keeps claiming pairs. */
+    int threads = pool_threads(jobs);
+    size_t workers = (pairCount + depth - 1) / depth;
+    if (workers > (size_t)threads) {
+        workers = threads;
+    }
+    pool_run(workers, threads, uring_worker, &b);
+
+    pthread_mutex_destroy(&b.lock);
+    return 1;
+}
+
+#else
+
+int uring_batch_run(char** paths, size_t pairCount, int* results, int jobs, int depth) {
+    (void)paths;
+    (void)pairCount;
+    (void)results;
+    (void)jobs;
+    (void)depth;
+    return 0;
+}
+
+#endif